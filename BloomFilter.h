@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+
+//Approximate membership filter, never answers false for a key that was added
+class BloomFilter{
+private:
+    std::vector<uint64_t> bits;
+    uint32_t nbits;
+    uint32_t k;
+
+    static uint64_t mix(uint64_t h){
+        //splitmix64 finalizer, std::hash is the identity for integers
+        h ^= h >> 30;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 27;
+        h *= 0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h;
+    }
+
+public:
+    BloomFilter(){
+        this->nbits = 0;
+        this->k = 0;
+    }
+
+    BloomFilter(unsigned int n, unsigned int bitsPerKey){
+        this->nbits = n * bitsPerKey;
+        if(this->nbits < 64)
+            this->nbits = 64;
+        //k = ln(2) * bits per key minimises the false positive rate
+        this->k = bitsPerKey * 69 / 100;
+        if(this->k < 1)
+            this->k = 1;
+        if(this->k > 30)
+            this->k = 30;
+        this->bits.assign((this->nbits + 63) / 64, 0);
+    }
+
+    template<class Key> static uint64_t hash(const Key& key){
+        return mix(std::hash<Key>()(key));
+    }
+
+    void add(uint64_t h){
+        uint64_t delta = (h >> 33) | (h << 31);
+        for(uint32_t i=0; i<this->k; i++){
+            uint32_t bit = h % this->nbits;
+            this->bits[bit >> 6] |= (uint64_t)1 << (bit & 63);
+            h += delta;
+        }
+    }
+
+    bool mayContain(uint64_t h) const{
+        if(this->nbits == 0)
+            return true;
+        uint64_t delta = (h >> 33) | (h << 31);
+        for(uint32_t i=0; i<this->k; i++){
+            uint32_t bit = h % this->nbits;
+            if((this->bits[bit >> 6] & ((uint64_t)1 << (bit & 63))) == 0)
+                return false;
+            h += delta;
+        }
+        return true;
+    }
+
+    void write(std::ostream& file) const{
+        file.write((char*)&this->nbits, sizeof(this->nbits));
+        file.write((char*)&this->k, sizeof(this->k));
+        file.write((char*)this->bits.data(), this->bits.size() * sizeof(uint64_t));
+    }
+
+    void read(std::istream& file){
+        file.read((char*)&this->nbits, sizeof(this->nbits));
+        file.read((char*)&this->k, sizeof(this->k));
+        this->bits.assign((this->nbits + 63) / 64, 0);
+        file.read((char*)this->bits.data(), this->bits.size() * sizeof(uint64_t));
+    }
+};
@@ -0,0 +1,205 @@
+#pragma once
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <vector>
+
+//Interface for page compression codecs. Every codec is identified on disk by
+//a one byte tag written in front of the page, so pages saved with different
+//codecs can live in the same tree.
+class Codec{
+public:
+    virtual unsigned char tag() const = 0;
+    virtual void compress(const char* in, size_t n, std::string& out) = 0;
+    virtual bool decompress(const char* in, size_t n, char* out, size_t rawSize) = 0;
+    //Largest payload n stored bytes can decompress to, larger raw sizes in a
+    //page header mean the header is corrupt
+    virtual uint64_t maxRawSize(uint64_t /*n*/) const { return UINT64_MAX; }
+    virtual ~Codec() {};
+
+    static Codec** registry(){
+        static Codec* codecs[256] = {NULL};
+        return codecs;
+    }
+
+    static void registerCodec(Codec* codec){
+        registry()[codec->tag()] = codec;
+    }
+
+    static Codec* forTag(unsigned char tag);
+};
+
+//Stores pages as they are
+class RawCodec : public Codec{
+public:
+    static const unsigned char TAG = 0;
+
+    unsigned char tag() const{
+        return TAG;
+    }
+
+    void compress(const char* in, size_t n, std::string& out){
+        out.assign(in, n);
+    }
+
+    uint64_t maxRawSize(uint64_t n) const{
+        return n;
+    }
+
+    bool decompress(const char* in, size_t n, char* out, size_t rawSize){
+        if(n != rawSize)
+            return false;
+        memcpy(out, in, n);
+        return true;
+    }
+};
+
+//Byte oriented LZ77 codec using the LZ4 block layout: every sequence is a
+//token (literal length << 4 | match length - 4), optional length extension
+//bytes, the literals, and a 2 byte little endian match offset.
+class LZCodec : public Codec{
+private:
+    static const int MIN_MATCH = 4;
+    static const int HASH_BITS = 12;
+    static const size_t MAX_OFFSET = 65535;
+    //the last bytes of a block are always emitted as literals
+    static const size_t LAST_LITERALS = 5;
+
+    static uint32_t read32(const char* p){
+        uint32_t v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static uint32_t hash(uint32_t v){
+        return (v * 2654435761U) >> (32 - HASH_BITS);
+    }
+
+    static void writeLength(std::string& out, size_t len){
+        while(len >= 255){
+            out.push_back((char)255);
+            len -= 255;
+        }
+        out.push_back((char)len);
+    }
+
+    static void writeSequence(std::string& out, const char* literals, size_t literalLength, size_t offset, size_t matchLength){
+        unsigned char token = (literalLength >= 15 ? 15 : literalLength) << 4;
+        if(matchLength > 0){
+            size_t m = matchLength - MIN_MATCH;
+            token |= (m >= 15 ? 15 : m);
+        }
+        out.push_back((char)token);
+        if(literalLength >= 15)
+            writeLength(out, literalLength - 15);
+        out.append(literals, literalLength);
+        if(matchLength > 0){
+            out.push_back((char)(offset & 0xff));
+            out.push_back((char)(offset >> 8));
+            if(matchLength - MIN_MATCH >= 15)
+                writeLength(out, matchLength - MIN_MATCH - 15);
+        }
+    }
+
+    static bool readLength(const unsigned char*& p, const unsigned char* end, size_t& len){
+        unsigned char b;
+        do {
+            if(p >= end)
+                return false;
+            b = *p++;
+            len += b;
+        } while(b == 255);
+        return true;
+    }
+
+public:
+    static const unsigned char TAG = 1;
+
+    unsigned char tag() const{
+        return TAG;
+    }
+
+    void compress(const char* in, size_t n, std::string& out){
+        out.clear();
+        out.reserve(n / 2 + 16);
+        std::vector<int64_t> table(1 << HASH_BITS, -1);
+
+        size_t anchor = 0;
+        size_t pos = 0;
+        while(n > LAST_LITERALS + MIN_MATCH && pos < n - LAST_LITERALS - MIN_MATCH){
+            uint32_t h = hash(read32(in + pos));
+            int64_t candidate = table[h];
+            table[h] = pos;
+            if(candidate < 0 || pos - candidate > MAX_OFFSET || read32(in + candidate) != read32(in + pos)){
+                pos++;
+                continue;
+            }
+            size_t matchLength = MIN_MATCH;
+            while(pos + matchLength < n - LAST_LITERALS && in[candidate + matchLength] == in[pos + matchLength]){
+                matchLength++;
+            }
+            writeSequence(out, in + anchor, pos - anchor, pos - candidate, matchLength);
+            pos += matchLength;
+            anchor = pos;
+        }
+        writeSequence(out, in + anchor, n - anchor, 0, 0);
+    }
+
+    //no stored byte stands for more than the 255 of a length extension byte
+    uint64_t maxRawSize(uint64_t n) const{
+        return n * 255 + MIN_MATCH + 15;
+    }
+
+    bool decompress(const char* in, size_t n, char* out, size_t rawSize){
+        const unsigned char* p = (const unsigned char*)in;
+        const unsigned char* end = p + n;
+        size_t written = 0;
+        while(p < end){
+            unsigned char token = *p++;
+            size_t literalLength = token >> 4;
+            if(literalLength == 15 && !readLength(p, end, literalLength))
+                return false;
+            if(literalLength > (size_t)(end - p) || literalLength > rawSize - written)
+                return false;
+            memcpy(out + written, p, literalLength);
+            p += literalLength;
+            written += literalLength;
+            if(p == end)
+                break;
+
+            if(end - p < 2)
+                return false;
+            size_t offset = p[0] | (p[1] << 8);
+            p += 2;
+            size_t matchLength = token & 15;
+            if(matchLength == 15 && !readLength(p, end, matchLength))
+                return false;
+            matchLength += MIN_MATCH;
+            if(offset == 0 || offset > written || matchLength > rawSize - written)
+                return false;
+            //byte by byte since the match may overlap the output
+            for(size_t i=0; i<matchLength; i++){
+                out[written + i] = out[written - offset + i];
+            }
+            written += matchLength;
+        }
+        return written == rawSize;
+    }
+};
+
+inline Codec* Codec::forTag(unsigned char tag){
+    static RawCodec raw;
+    static LZCodec lz;
+    Codec** codecs = registry();
+    //the built-in codecs are filled in once, pages are read and written
+    //from several threads
+    static bool builtIn = [codecs]{
+        if(codecs[RawCodec::TAG] == NULL)
+            codecs[RawCodec::TAG] = &raw;
+        if(codecs[LZCodec::TAG] == NULL)
+            codecs[LZCodec::TAG] = &lz;
+        return true;
+    }();
+    (void)builtIn;
+    return codecs[tag];
+}
@@ -12,21 +12,15 @@ public:
         this->order = order;
         this->is_open =false;
     }
-    void save(){
-        if(this->dirty == false){
-            return;
-        }
-        this->filename = this->getId();
+    CompoundObjectsFlatPage* newPassivePage(const std::string& id){
+        return new CompoundObjectsFlatPage(id, this->order);
+    }
 
-        std::ofstream file;
-        std::ofstream metafile;
-        if(this->bottom){
-            file.open(this->filename + ".values.idx");
-        } else {
-            file.open(this->filename + ".idx");
-            metafile.open(this->filename + ".meta.idx");
-        }
+    CompoundObjectsFlatPage* newPage(bool bottom){
+        return new CompoundObjectsFlatPage(this->order, bottom);
+    }
 
+    void store(std::ostream& file, std::ostream& metafile){
         file << this->size <<  std::endl;
         //copy iteratively
         for(int i=0; i<this->size; i++){
@@ -38,35 +32,21 @@ public:
             }
         } else {
             for(int i=0; i<this->size; i++){
-                this->pages[i]->save();
+                file << this->counts[i] << FlatPage<Key, Value>::RECORD_SEPARATOR;
                 metafile << this->pages[i]->getId() << FlatPage<Key, Value>::RECORD_SEPARATOR;
             }
+            for(int i=0; i<this->size; i++){
+                file << this->summaries[i] << FlatPage<Key, Value>::RECORD_SEPARATOR;
+            }
         }
     }
 
-    void open(bool reload=false){
-        if(this->is_open && !reload)
-            return;
-        this->filename = this->getId();
-        this->bottom = false;
-        std::ifstream file;
-        std::ifstream metafile;
-        file.open(this->filename + ".idx");
-        if(!file.is_open()){
-            file.close();
-            file.open(this->filename + ".values.idx");
-            this->bottom = true;
-            if(!file.is_open()){
-                std::cout << "Error: File not found" << std::endl;
-                assert(false);
-            }    
-        } else {
-            metafile.open(this->filename + ".meta.idx");
-        }
-        
+    void load(std::istream& file, std::istream& metafile){
         std::string size_str;
         getline(file, size_str);
-        this->size = std::stoi(size_str);
+        this->size = std::stoul(size_str);
+        if(!this->fits(this->size))
+            this->size = 0;
 
         this->keys = new Key[2*this->order];
         for(int i=0; i<this->size; i++){
@@ -83,13 +63,25 @@ public:
             }
         } else {
             this->pages = new Page<Key, Value>*[2*this->order];
+            this->counts = new uint64_t[2*this->order];
             for(int i=0; i<this->size; i++){
+                //pages saved before subtree counts were kept have none
+                std::string count_str;
+                if(getline(file, count_str, FlatPage<Key, Value>::RECORD_SEPARATOR) && !count_str.empty())
+                    this->counts[i] = std::stoull(count_str);
+                else
+                    this->counts[i] = Page<Key, Value>::UNCOUNTED;
                 std::string page_str;
                 getline(metafile, page_str, FlatPage<Key, Value>::RECORD_SEPARATOR);
-                this->pages[i] = new CompoundObjectsFlatPage<Key, Value>(page_str, this->order);
+                this->pages[i] = this->newPassivePage(page_str);
+            }
+            this->summaries = new Value[2*this->order];
+            for(int i=0; i<this->size; i++){
+                std::string summary_str;
+                getline(file, summary_str, FlatPage<Key, Value>::RECORD_SEPARATOR);
+                this->summaries[i] = summary_str;
             }
         }
-        this->is_open = true;
     }
 
     void print(){
@@ -118,23 +110,32 @@ public:
 
     CompoundObjectsFlatPage* split(){
         this->open();
+        return this->split(this->size / 2 + (this->size % 2));
+    }
 
-        CompoundObjectsFlatPage* page = new CompoundObjectsFlatPage(this->order, this->bottom);
-        int half = this->size / 2 + (this->size % 2);
-        int otherHalf = this->size - half;
-        //memcpy(page->keys, this->keys + half, otherHalf * sizeof(Key));
-        for(int i=0; i<otherHalf; i++){
-            page->keys[i] = this->keys[i + half];
+    CompoundObjectsFlatPage* split(unsigned int at){
+        this->open();
+        Stats::add(Stats::SPLITS);
+
+        CompoundObjectsFlatPage* page = this->newPage(this->bottom);
+        int moved = this->size - at;
+        //memcpy(page->keys, this->keys + at, moved * sizeof(Key));
+        for(int i=0; i<moved; i++){
+            page->keys[i] = this->keys[i + at];
         }
-        this->size = half;
-        page->size = otherHalf;
+        this->size = at;
+        page->size = moved;
         if( this->bottom) {
-            //memcpy(page->values, this->values + half, otherHalf * sizeof(Value));
-            for(int i=0; i<otherHalf; i++){
-                page->values[i] = this->values[i + half];
+            //memcpy(page->values, this->values + at, moved * sizeof(Value));
+            for(int i=0; i<moved; i++){
+                page->values[i] = this->values[i + at];
             }
         } else {
-            memcpy(page->pages, this->pages + half, half * sizeof(CompoundObjectsFlatPage*));
+            memcpy(page->pages, this->pages + at, moved * sizeof(CompoundObjectsFlatPage*));
+            memcpy(page->counts, this->counts + at, moved * sizeof(uint64_t));
+            for(int i=0; i<moved; i++){
+                page->summaries[i] = this->summaries[i + at];
+            }
         }
         this->dirty = true;
         page->dirty = true;
@@ -153,6 +154,7 @@ public:
             int mid = first + (last - first) / 2;
             if (this->keys[mid] == key) {
                 this->values[mid] = value;
+                this->dirty = true;
                 return;
             }
             if (this->keys[mid] < key) {
@@ -173,11 +175,43 @@ public:
         this->keys[first] = key;
         this->values[first] = value;
         this->size++;
+        this->addToFilter(key);
 
         this->dirty = true;
 
     }
 
+    Value* findOrAdd(Key key, const Value& value, bool& inserted){
+        assert(this->isExternal());
+        this->open();
+        this->dirty = true;
+        int first = 0;
+        int last = this->size - 1;
+        while(first <= last){
+            int mid = first + (last - first) / 2;
+            if (this->keys[mid] == key) {
+                inserted = false;
+                return &this->values[mid];
+            }
+            if (this->keys[mid] < key) {
+                first = mid + 1;
+            } else {
+                last = mid - 1;
+            }
+        }
+        for(int i=this->size; i>first; i--){
+            this->keys[i] = this->keys[i-1];
+            this->values[i] = this->values[i-1];
+        }
+
+        this->keys[first] = key;
+        this->values[first] = value;
+        this->size++;
+        this->addToFilter(key);
+        inserted = true;
+        return &this->values[first];
+    }
+
     void add(Key key, Page<Key, Value>* page){
         assert(!this->isExternal());
         this->open();
@@ -189,6 +223,9 @@ public:
             int mid = first + (last - first) / 2;
             if (this->keys[mid] == key) {
                 this->pages[mid] = page;
+                this->counts[mid] = Page<Key, Value>::UNCOUNTED;
+                this->summaries[mid] = Value();
+                this->dirty = true;
                 return;
             }
             if (this->keys[mid] < key) {
@@ -202,10 +239,14 @@ public:
         //memmove(this->keys + first + 1, this->keys + first, (this->size - first) * sizeof(Key));
         for(int i=this->size; i>first; i--){
             this->keys[i] = this->keys[i-1];
+            this->summaries[i] = this->summaries[i-1];
         }
         memmove(this->pages + first + 1, this->pages + first, (this->size - first) * sizeof(CompoundObjectsFlatPage*));
+        memmove(this->counts + first + 1, this->counts + first, (this->size - first) * sizeof(uint64_t));
         this->keys[first] = key;
         this->pages[first] = page;
+        this->counts[first] = Page<Key, Value>::UNCOUNTED;
+        this->summaries[first] = Value();
         this->size++;
 
         this->dirty = true;
@@ -213,8 +254,11 @@ public:
     
     Page<Key, Value>* merge(Page<Key, Value>* page) {
         this->open();
+        Stats::add(Stats::MERGES);
 
         CompoundObjectsFlatPage* flatPage = (CompoundObjectsFlatPage*)page;
+        //a neighbour read from disk may not be loaded yet
+        flatPage->open();
         for(int i=0; i<flatPage->size; i++){
             this->keys[this->size + i] = flatPage->keys[i];
         }
@@ -223,11 +267,16 @@ public:
             //memcpy(this->values + this->size, flatPage->values, flatPage->size * sizeof(Value));
             for(int i=0; i<flatPage->size; i++){
                 this->values[this->size + i] = flatPage->values[i];
+                this->addToFilter(flatPage->keys[i]);
             }
             this->size += flatPage->size;
         } else {
             //memcpy(this->keys + this->size, flatPage->keys, flatPage->size * sizeof(Key));
             memcpy(this->pages + this->size, flatPage->pages, flatPage->size * sizeof(CompoundObjectsFlatPage*));
+            memcpy(this->counts + this->size, flatPage->counts, flatPage->size * sizeof(uint64_t));
+            for(int i=0; i<flatPage->size; i++){
+                this->summaries[this->size + i] = flatPage->summaries[i];
+            }
             this->size += flatPage->size;
         }
 
@@ -254,6 +303,7 @@ public:
                         this->values[i] = this->values[i+1];
                     }
                     this->size--;
+                    this->dirty = true;
                     return;
                 }
                 if (this->keys[mid] < key) {
@@ -272,9 +322,12 @@ public:
                     //memmove(this->keys + mid, this->keys + mid + 1, (this->size - mid - 1) * sizeof(Key));
                     for(int i=mid; i<this->size-1; i++){
                         this->keys[i] = this->keys[i+1];
+                        this->summaries[i] = this->summaries[i+1];
                     }
                     memmove(this->pages + mid, this->pages + mid + 1, (this->size - mid - 1) * sizeof(CompoundObjectsFlatPage*));
+                    memmove(this->counts + mid, this->counts + mid + 1, (this->size - mid - 1) * sizeof(uint64_t));
                     this->size--;
+                    this->dirty = true;
                     return;
                 }
                 if (this->keys[mid] < key) {
@@ -286,4 +339,21 @@ public:
         }
         this->dirty = true;
     }
+
+    void removeAt(unsigned int index, unsigned int entries){
+        this->open();
+        for(unsigned int i=index; i+entries<this->size; i++){
+            this->keys[i] = this->keys[i+entries];
+            if (this->bottom)
+                this->values[i] = this->values[i+entries];
+            else
+                this->summaries[i] = this->summaries[i+entries];
+        }
+        if (!this->bottom) {
+            memmove(this->pages + index, this->pages + index + entries, (this->size - index - entries) * sizeof(CompoundObjectsFlatPage*));
+            memmove(this->counts + index, this->counts + index + entries, (this->size - index - entries) * sizeof(uint64_t));
+        }
+        this->size -= entries;
+        this->dirty = true;
+    }
 };
\ No newline at end of file
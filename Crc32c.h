@@ -0,0 +1,84 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#define CRC32C_HARDWARE
+#endif
+
+//CRC-32C (Castagnoli polynomial), the checksum of iSCSI, ext4 and SSE4.2.
+//compute() uses the crc32 instruction where the CPU has it, eight bytes at
+//a time, and a table a byte at a time otherwise.
+class Crc32c{
+private:
+    static const uint32_t POLYNOMIAL = 0x82f63b78; // reflected
+
+    struct Table{
+        uint32_t entries[256];
+
+        Table(){
+            for(uint32_t i=0; i<256; i++){
+                uint32_t crc = i;
+                for(int bit=0; bit<8; bit++){
+                    crc = (crc >> 1) ^ (crc & 1 ? POLYNOMIAL : 0);
+                }
+                this->entries[i] = crc;
+            }
+        }
+    };
+
+    static const Table& table(){
+        static const Table table;
+        return table;
+    }
+
+public:
+    //Checksum of data, continuing the checksum crc of the bytes before it
+    static uint32_t compute(const void* data, size_t size, uint32_t crc = 0){
+#ifdef CRC32C_HARDWARE
+        if(Crc32c::hasHardware())
+            return Crc32c::hardware(data, size, crc);
+#endif
+        return Crc32c::software(data, size, crc);
+    }
+
+    static uint32_t software(const void* data, size_t size, uint32_t crc = 0){
+        const Table& table = Crc32c::table();
+        const unsigned char* bytes = (const unsigned char*)data;
+        crc = ~crc;
+        for(size_t i=0; i<size; i++){
+            crc = table.entries[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+    }
+
+    static bool hasHardware(){
+#ifdef CRC32C_HARDWARE
+        static const bool sse42 = __builtin_cpu_supports("sse4.2");
+        return sse42;
+#else
+        return false;
+#endif
+    }
+
+#ifdef CRC32C_HARDWARE
+    //Only to be called when hasHardware()
+    __attribute__((target("sse4.2")))
+    static uint32_t hardware(const void* data, size_t size, uint32_t crc = 0){
+        const unsigned char* bytes = (const unsigned char*)data;
+        uint64_t crc64 = ~crc;
+        for(; size >= 8; size -= 8, bytes += 8){
+            uint64_t word;
+            memcpy(&word, bytes, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        uint32_t crc32 = (uint32_t)crc64;
+        for(; size > 0; size--, bytes++){
+            crc32 = _mm_crc32_u8(crc32, *bytes);
+        }
+        return ~crc32;
+    }
+#endif
+};
@@ -7,8 +7,16 @@
 #include <random>
 #include <chrono>
 #include <string>
+#include <sstream>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
 
 #include "Page.h"
+#include "PageFile.h"
+#include "BloomFilter.h"
+#include "Prefetcher.h"
+#include "Stats.h"
 
 template<class Key, class Value> class FlatPage : public Page<Key, Value>{
 protected:
@@ -16,6 +24,10 @@ protected:
     Key* keys;
     Value* values;
     Page<Key, Value>** pages;
+    //leaf entries under each child of an internal page, UNCOUNTED if unknown
+    uint64_t* counts;
+    //summaries of the values under each child, kept by Btree
+    Value* summaries;
 
     unsigned int size;
     unsigned int order;
@@ -24,9 +36,72 @@ protected:
     bool is_open;
     std::string filename;
     static const char RECORD_SEPARATOR = 30;
+    static const size_t PREFETCH_BYTES = 512;
     std::string id;
+    static Codec* codec;
+    static int filterBitsPerKey;
+    //resident membership filter of a leaf, NULL answers every probe with maybe
+    BloomFilter* filter;
+    bool filterLoaded;
+
+    //Reads the files of this page, the page is internal if it has an index file
+    void readFiles(std::string& data, std::string& meta){
+        bool ok;
+        Stats::add(Stats::PAGE_LOADS);
+        if(Prefetcher::instance().take(this->filename, this->bottom, data, meta, ok)){
+            Stats::add(Stats::PREFETCHED_LOADS);
+            if(!ok){
+                std::cout << "Error: could not read page " << this->filename << std::endl;
+                assert(false);
+            }
+            return;
+        }
+        this->bottom = false;
+        if(PageFile::exists(this->filename + ".idx")){
+            if(!PageFile::read(this->filename + ".idx", data) || !PageFile::read(this->filename + ".meta.idx", meta)){
+                assert(false);
+            }
+        } else {
+            this->bottom = true;
+            if(!PageFile::exists(this->filename + ".values.idx")){
+                std::cout << "Error: File not found" << std::endl;
+                assert(false);
+            }
+            if(!PageFile::read(this->filename + ".values.idx", data)){
+                assert(false);
+            }
+        }
+    }
+
+    void writeFiles(const std::string& data, const std::string& meta){
+        if(this->bottom){
+            PageFile::write(this->filename + ".values.idx", data, FlatPage::codec);
+        } else {
+            PageFile::write(this->filename + ".idx", data, FlatPage::codec);
+            PageFile::write(this->filename + ".meta.idx", meta, FlatPage::codec);
+        }
+    }
 
 public:
+    //Codec used for the pages saved from now on, NULL stores them raw
+    static void setCodec(Codec* codec){
+        FlatPage::codec = codec;
+    }
+
+    //Bits per key of the filters saved with leaves from now on, 0 disables them
+    static void setFilterBitsPerKey(int bits){
+        FlatPage::filterBitsPerKey = bits;
+    }
+
+    //Deletes every file a page with this id may have been saved to
+    static void removeFiles(const std::string& id){
+        std::remove((id + ".idx").c_str());
+        std::remove((id + ".meta.idx").c_str());
+        std::remove((id + ".values.idx").c_str());
+        std::remove((id + ".filter.idx").c_str());
+        Prefetcher::instance().drop(id);
+    }
+
     std::string getId() const{
         return this->id;
     }
@@ -36,18 +111,34 @@ public:
         this->keys = NULL;
         this->values = NULL;
         this->pages = NULL;
+        this->counts = NULL;
+        this->summaries = NULL;
+        this->bottom = false;
+        this->dirty = false;
+        this->filter = NULL;
+        this->filterLoaded = false;
     }
 
     FlatPage(const std::string& id, int order){
         this->id = id;
         this->order = order;
+        this->size = 0;
+        this->keys = NULL;
+        this->values = NULL;
+        this->pages = NULL;
+        this->counts = NULL;
+        this->summaries = NULL;
+        this->bottom = false;
+        this->dirty = false;
+        this->filter = NULL;
+        this->filterLoaded = false;
         this->is_open = false;
     }
 
     void generateId(){
         auto now = std::chrono::system_clock::now().time_since_epoch().count();
-        std::random_device rd;
-        std::mt19937 gen(rd());
+        //seeding a generator reads the random device, do it once per thread
+        thread_local std::mt19937 gen(std::random_device{}());
         std::uniform_int_distribution<> dis(1, 1000000);
         this->id = std::to_string(now) + "_" + std::to_string(dis(gen));
     }
@@ -60,60 +151,53 @@ public:
         this->bottom = bottom;
         this->size = 0;
         this->keys = new Key[2*order];
+        this->values = NULL;
+        this->pages = NULL;
+        this->counts = NULL;
+        this->summaries = NULL;
         if(!bottom){
             this->pages = new Page<Key, Value>*[2*order];
+            this->counts = new uint64_t[2*order];
+            this->summaries = new Value[2*order];
         } else {
             this->values = new Value[2*order];
         }
+        this->dirty = true;
+        this->filter = NULL;
+        this->filterLoaded = true;
         this->is_open = true;
     }
 
-    void save(){
-        this->filename = this->id;
-        std::ofstream file;
-        std::ofstream metafile;
-        if(this->bottom){
-            file.open(filename + ".values.idx");
-        } else {
-            file.open(filename + ".idx");
-            metafile.open(filename + ".meta.idx");
-        }
+    //Whether a size read from the files of the page fits its arrays, a
+    //larger one means the files are corrupt
+    bool fits(unsigned int size){
+        if(size <= 2*this->order)
+            return true;
+        std::cout << "Error: page " << this->id << " claims " << size << " entries, at most " << 2*this->order << " fit" << std::endl;
+        assert(false);
+        return false;
+    }
+
+    //Serializes the page, child ids of internal pages go to the meta file
+    virtual void store(std::ostream& file, std::ostream& metafile){
         file.write((char*)&this->size, sizeof(this->size));
         //copy using memcopy
         file.write((char*)this->keys, this->size * sizeof(Key));
         if(this->bottom){
             file.write((char*)this->values, this->size * sizeof(Value));
         } else {
+            file.write((char*)this->counts, this->size * sizeof(uint64_t));
+            file.write((char*)this->summaries, this->size * sizeof(Value));
             for(int i=0; i<this->size; i++){
-                this->pages[i]->save();
                 metafile << this->pages[i]->getId() << RECORD_SEPARATOR;
             }
         }
-        file.close();
-        metafile.close();
     }
 
-    virtual void open(bool reload=false){
-        if(this->is_open && !reload)
-            return;
-        this->filename = this->id;
-        this->bottom = false;
-        std::ifstream file;
-        std::ifstream metafile;
-        file.open(filename + ".idx");
-        if(!file.is_open()){
-            file.close();
-            file.open(filename + ".values.idx");
-            this->bottom = true;
-            if(!file.is_open()){
-                std::cout << "Error: File not found" << std::endl;
-                assert(false);
-            }
-        } else {
-            metafile.open(filename + ".meta.idx");
-        }
-
+    virtual void load(std::istream& file, std::istream& metafile){
         file.read((char*)&this->size, sizeof(this->size));
+        if(!this->fits(this->size))
+            this->size = 0;
 
         //copy using memcopy
         this->keys = new Key[2*this->order];
@@ -128,12 +212,160 @@ public:
             file.read((char*)this->values, this->size * sizeof(Value));
         } else {
             this->pages = new Page<Key, Value>*[2*this->order];
+            this->counts = new uint64_t[2*this->order];
+            file.read((char*)this->counts, this->size * sizeof(uint64_t));
+            //pages saved before subtree counts were kept have none
+            if(file.gcount() != (std::streamsize)(this->size * sizeof(uint64_t))){
+                std::fill(this->counts, this->counts + this->size, Page<Key, Value>::UNCOUNTED);
+            }
+            this->summaries = new Value[2*this->order];
+            file.read((char*)this->summaries, this->size * sizeof(Value));
             for(int i=0; i<this->size; i++){
                 std::string page_str;
                 getline(metafile, page_str, FlatPage<Key, Value>::RECORD_SEPARATOR);
-                this->pages[i] = new FlatPage(page_str, this->order);
+                this->pages[i] = this->newPassivePage(page_str);
+            }
+        }
+    }
+
+    //Passive page of the same type, used for the children of loaded pages
+    virtual FlatPage* newPassivePage(const std::string& id){
+        return new FlatPage(id, this->order);
+    }
+
+    virtual FlatPage* newPage(bool bottom){
+        return new FlatPage(this->order, bottom);
+    }
+
+    void save(){
+        this->save(NULL);
+    }
+
+    //Shadow paging: with relocated, a changed page is never written over
+    //the files it was loaded from or last saved to but under a new id, and
+    //the parent that names it changes with it
+    void save(std::vector<std::string>* relocated){
+        std::vector<Page<Key, Value>*> writes;
+        this->collect(relocated, writes);
+        for(size_t i=0; i<writes.size(); i++){
+            writes[i]->write();
+        }
+    }
+
+    void collect(std::vector<std::string>* relocated, std::vector<Page<Key, Value>*>& writes){
+        //pages that were never loaded are unchanged on disk
+        if(!this->is_open)
+            return;
+        //children may be dirty even when this page is not
+        if(!this->bottom){
+            for(int i=0; i<this->size; i++){
+                std::string id = this->pages[i]->getId();
+                this->pages[i]->collect(relocated, writes);
+                if(this->pages[i]->getId() != id)
+                    this->dirty = true;
             }
         }
+        if(!this->dirty)
+            return;
+        if(relocated != NULL && this->filename != ""){
+            relocated->push_back(this->id);
+            this->generateId();
+        }
+        writes.push_back(this);
+    }
+
+    void write(){
+        this->filename = this->id;
+        std::ostringstream file;
+        std::ostringstream metafile;
+        this->store(file, metafile);
+        this->writeFiles(file.str(), metafile.str());
+        Stats::add(Stats::PAGE_WRITES);
+        if(this->bottom){
+            this->saveFilter();
+        }
+        this->dirty = false;
+    }
+
+    void saveFilter(){
+        delete this->filter;
+        this->filter = NULL;
+        this->filterLoaded = true;
+        if(FlatPage::filterBitsPerKey <= 0){
+            //a filter left over from an earlier save would miss new keys
+            std::remove((this->id + ".filter.idx").c_str());
+            return;
+        }
+        this->filter = new BloomFilter(this->size, FlatPage::filterBitsPerKey);
+        for(int i=0; i<this->size; i++){
+            this->filter->add(BloomFilter::hash(this->getKeyAt(i)));
+        }
+        std::ostringstream file;
+        this->filter->write(file);
+        PageFile::write(this->id + ".filter.idx", file.str(), NULL);
+    }
+
+    void loadFilter(){
+        this->filterLoaded = true;
+        if(FlatPage::filterBitsPerKey <= 0 || !PageFile::exists(this->id + ".filter.idx"))
+            return;
+        std::string data;
+        if(!PageFile::read(this->id + ".filter.idx", data))
+            return;
+        std::istringstream file(data);
+        this->filter = new BloomFilter();
+        this->filter->read(file);
+    }
+
+    void addToFilter(Key key){
+        //the filter on disk predates the key, the page goes without one
+        //until its next save builds a new one
+        if(!this->filterLoaded){
+            this->filter = NULL;
+            this->filterLoaded = true;
+        }
+        if(this->filter != NULL)
+            this->filter->add(BloomFilter::hash(key));
+    }
+
+    //Starts reading a passive page in the background, or pulls the keys of
+    //an open page into the cache ahead of the binary search over them
+    void prefetch(){
+        if(!this->is_open){
+            Prefetcher::instance().prefetch(this->id);
+            return;
+        }
+        const char* begin = (const char*)this->keys;
+        size_t bytes = this->size * sizeof(Key);
+        for(size_t offset=0; offset<bytes && offset<PREFETCH_BYTES; offset+=64){
+            __builtin_prefetch(begin + offset);
+        }
+    }
+
+    //Probes the leaf filter, loading only the filter file of a passive page
+    bool mayContain(Key key){
+        if(!this->filterLoaded)
+            this->loadFilter();
+        if(this->filter == NULL)
+            return true;
+        Stats::add(Stats::FILTER_PROBES);
+        if(this->filter->mayContain(BloomFilter::hash(key)))
+            return true;
+        Stats::add(Stats::FILTER_NEGATIVES);
+        return false;
+    }
+
+    virtual void open(bool reload=false){
+        if(this->is_open && !reload)
+            return;
+        this->filename = this->id;
+        std::string data;
+        std::string meta;
+        this->readFiles(data, meta);
+        std::istringstream file(data);
+        std::istringstream metafile(meta);
+        this->load(file, metafile);
+        this->dirty = false;
         this->is_open = true;
     }
 
@@ -245,6 +477,43 @@ public:
         return this->pages[index];
     }
 
+    void setPageAt(int index, Page<Key, Value>* page){
+        assert(!this->bottom);
+        this->open();
+        this->pages[index] = page;
+        this->dirty = true;
+    }
+
+    uint64_t getCountAt(int index){
+        assert(!this->bottom);
+        this->open();
+        return this->counts[index];
+    }
+
+    void setCountAt(int index, uint64_t count){
+        assert(!this->bottom);
+        this->open();
+        if(this->counts[index] == count)
+            return;
+        this->counts[index] = count;
+        this->dirty = true;
+    }
+
+    Value* getSummaryAt(int index){
+        assert(!this->bottom);
+        this->open();
+        return &this->summaries[index];
+    }
+
+    void setSummaryAt(int index, const Value& summary){
+        assert(!this->bottom);
+        this->open();
+        if(this->summaries[index] == summary)
+            return;
+        this->summaries[index] = summary;
+        this->dirty = true;
+    }
+
     void add(Key key, Value value){
         assert(this->bottom);
         this->open();
@@ -255,6 +524,7 @@ public:
             int mid = first + (last - first) / 2;
             if (this->keys[mid] == key) {
                 this->values[mid] = value;
+                this->dirty = true;
                 return;
             }
             if (this->keys[mid] < key) {
@@ -271,8 +541,81 @@ public:
         this->keys[first] = key;
         this->values[first] = value;
         this->size++;
+        this->addToFilter(key);
+
+        this->dirty = true;
+    }
 
+    Value* findOrAdd(Key key, const Value& value, bool& inserted){
+        assert(this->bottom);
+        this->open();
         this->dirty = true;
+        int first = 0;
+        int last = this->size - 1;
+        while(first <= last){
+            int mid = first + (last - first) / 2;
+            if (this->keys[mid] == key) {
+                inserted = false;
+                return &this->values[mid];
+            }
+            if (this->keys[mid] < key) {
+                first = mid + 1;
+            } else {
+                last = mid - 1;
+            }
+        }
+        memmove(this->keys + first + 1, this->keys + first, (this->size - first) * sizeof(Key));
+        memmove(this->values + first + 1, this->values + first, (this->size - first) * sizeof(Value));
+
+        this->keys[first] = key;
+        this->values[first] = value;
+        this->size++;
+        this->addToFilter(key);
+        inserted = true;
+        return &this->values[first];
+    }
+
+    unsigned int addSorted(const std::pair<Key, Value>* entries, unsigned int n, unsigned int limit, unsigned int& inserted){
+        assert(this->bottom);
+        this->open();
+        //count the entries that fit and how many of them are new
+        unsigned int used = 0;
+        unsigned int i = 0;
+        inserted = 0;
+        while(used < n){
+            while(i < this->size && this->keys[i] < entries[used].first){
+                i++;
+            }
+            if(i == this->size || !(this->keys[i] == entries[used].first)){
+                if(this->size + inserted >= limit)
+                    break;
+                inserted++;
+            }
+            used++;
+        }
+        //merge from the back, so every old entry moves only once
+        int to = this->size + inserted - 1;
+        int old = this->size - 1;
+        for(int e=used-1; e>=0; e--){
+            const Key& key = entries[e].first;
+            while(old >= 0 && key < this->keys[old]){
+                this->keys[to] = this->keys[old];
+                this->values[to] = this->values[old];
+                to--;
+                old--;
+            }
+            if(old >= 0 && this->keys[old] == key){
+                old--;
+            } else {
+                this->addToFilter(key);
+            }
+            this->keys[to] = key;
+            this->values[to] = entries[e].second;
+            to--;
+        }
+        this->size += inserted;
+        this->dirty = true;
+        return used;
     }
 
     void add(Key key, Page<Key, Value>* page){
@@ -285,6 +628,9 @@ public:
             int mid = first + (last - first) / 2;
             if (this->keys[mid] == key) {
                 this->pages[mid] = page;
+                this->counts[mid] = Page<Key, Value>::UNCOUNTED;
+                this->summaries[mid] = Value();
+                this->dirty = true;
                 return;
             }
             if (this->keys[mid] < key) {
@@ -297,8 +643,12 @@ public:
         //Shift the keys and values to the right using memcopy
         memmove(this->keys + first + 1, this->keys + first, (this->size - first) * sizeof(Key));
         memmove(this->pages + first + 1, this->pages + first, (this->size - first) * sizeof(FlatPage*));
+        memmove(this->counts + first + 1, this->counts + first, (this->size - first) * sizeof(uint64_t));
+        memmove(this->summaries + first + 1, this->summaries + first, (this->size - first) * sizeof(Value));
         this->keys[first] = key;
         this->pages[first] = page;
+        this->counts[first] = Page<Key, Value>::UNCOUNTED;
+        this->summaries[first] = Value();
         this->size++;
         
         this->dirty = true;
@@ -331,16 +681,23 @@ public:
 
     FlatPage* split(){
         this->open();
-        FlatPage* page = new FlatPage(this->order, this->bottom);
-        int half = this->size / 2 + (this->size % 2);
-        int otherHalf = this->size - half;
-        memcpy(page->keys, this->keys + half, otherHalf * sizeof(Key));
-        this->size = half;
-        page->size = otherHalf;
+        return this->split(this->size / 2 + (this->size % 2));
+    }
+
+    FlatPage* split(unsigned int at){
+        this->open();
+        Stats::add(Stats::SPLITS);
+        FlatPage* page = this->newPage(this->bottom);
+        int moved = this->size - at;
+        memcpy(page->keys, this->keys + at, moved * sizeof(Key));
+        this->size = at;
+        page->size = moved;
         if( this->bottom) {
-            memcpy(page->values, this->values + half, otherHalf * sizeof(Value));
+            memcpy(page->values, this->values + at, moved * sizeof(Value));
         } else {
-            memcpy(page->pages, this->pages + half, half * sizeof(FlatPage*));
+            memcpy(page->pages, this->pages + at, moved * sizeof(FlatPage*));
+            memcpy(page->counts, this->counts + at, moved * sizeof(uint64_t));
+            memcpy(page->summaries, this->summaries + at, moved * sizeof(Value));
         }
 
         this->dirty = true;
@@ -398,14 +755,22 @@ public:
 
     Page<Key, Value>* merge(Page<Key, Value>* page) {
         this->open();
+        Stats::add(Stats::MERGES);
         FlatPage* flatPage = (FlatPage*)page;
+        //a neighbour read from disk may not be loaded yet
+        flatPage->open();
         if (this->bottom) {
             memcpy(this->keys + this->size, flatPage->keys, flatPage->size * sizeof(Key));
             memcpy(this->values + this->size, flatPage->values, flatPage->size * sizeof(Value));
+            for(int i=0; i<flatPage->size; i++){
+                this->addToFilter(flatPage->keys[i]);
+            }
             this->size += flatPage->size;
         } else {
             memcpy(this->keys + this->size, flatPage->keys, flatPage->size * sizeof(Key));
             memcpy(this->pages + this->size, flatPage->pages, flatPage->size * sizeof(FlatPage*));
+            memcpy(this->counts + this->size, flatPage->counts, flatPage->size * sizeof(uint64_t));
+            memcpy(this->summaries + this->size, flatPage->summaries, flatPage->size * sizeof(Value));
             this->size += flatPage->size;
         }
 
@@ -427,6 +792,7 @@ public:
                     memmove(this->keys + mid, this->keys + mid + 1, (this->size - mid - 1) * sizeof(Key));
                     memmove(this->values + mid, this->values + mid + 1, (this->size - mid - 1) * sizeof(Value));
                     this->size--;
+                    this->dirty = true;
                     return;
                 }
                 if (this->keys[mid] < key) {
@@ -444,7 +810,10 @@ public:
                     //erase
                     memmove(this->keys + mid, this->keys + mid + 1, (this->size - mid - 1) * sizeof(Key));
                     memmove(this->pages + mid, this->pages + mid + 1, (this->size - mid - 1) * sizeof(FlatPage*));
+                    memmove(this->counts + mid, this->counts + mid + 1, (this->size - mid - 1) * sizeof(uint64_t));
+                    memmove(this->summaries + mid, this->summaries + mid + 1, (this->size - mid - 1) * sizeof(Value));
                     this->size--;
+                    this->dirty = true;
                     return;
                 }
                 if (this->keys[mid] < key) {
@@ -458,6 +827,21 @@ public:
         this->dirty = true;
     }
 
+    void removeAt(unsigned int index, unsigned int entries){
+        this->open();
+        unsigned int tail = this->size - index - entries;
+        memmove(this->keys + index, this->keys + index + entries, tail * sizeof(Key));
+        if (this->bottom) {
+            memmove(this->values + index, this->values + index + entries, tail * sizeof(Value));
+        } else {
+            memmove(this->pages + index, this->pages + index + entries, tail * sizeof(FlatPage*));
+            memmove(this->counts + index, this->counts + index + entries, tail * sizeof(uint64_t));
+            memmove(this->summaries + index, this->summaries + index + entries, tail * sizeof(Value));
+        }
+        this->size -= entries;
+        this->dirty = true;
+    }
+
     void replaceKey(Key oldKey, Key newKey){
         this->open();
         int first = 0;
@@ -466,6 +850,7 @@ public:
             int mid = first + (last - first) / 2;
             if (this->keys[mid] == oldKey) {
                 this->keys[mid] = newKey;
+                this->dirty = true;
                 return;
             }
             if (this->keys[mid] < oldKey) {
@@ -503,32 +888,93 @@ public:
         return this->pages[this->size - 1];
     }
 
+    bool isOpen(){
+        return this->is_open;
+    }
+
     bool isFull(){
         this->open();
         return this->size >= this->order;
     }
 
-    void detach(){
-        if (this->bottom) {
-            this->values = NULL;
-            this->keys = NULL;
+    //Drops the in-memory copy of a clean page whose children are all passive,
+    //the page reloads from disk on its next use
+    bool close(){
+        if(!this->is_open || this->dirty)
+            return false;
+        if(!this->bottom){
+            for(int i=0; i<this->size; i++){
+                if(this->pages[i]->isOpen())
+                    return false;
+            }
+            for(int i=0; i<this->size; i++){
+                Page<Key, Value>::release(this->pages[i]);
+            }
+            delete[] this->pages;
+            this->pages = NULL;
+            delete[] this->counts;
+            this->counts = NULL;
+            delete[] this->summaries;
+            this->summaries = NULL;
         } else {
+            delete[] this->values;
+            this->values = NULL;
+        }
+        delete[] this->keys;
+        this->keys = NULL;
+        this->size = 0;
+        this->is_open = false;
+        return true;
+    }
+
+    //Lets go of the children, which now belong to another page; the
+    //entries of a leaf are copies and are freed with it
+    void detach(){
+        if (!this->bottom) {
+            delete[] this->pages;
             this->pages = NULL;
+            delete[] this->counts;
+            this->counts = NULL;
+            delete[] this->summaries;
+            this->summaries = NULL;
+        }
+    }
+
+    FlatPage* clone(){
+        this->open();
+        FlatPage* page = this->newPage(this->bottom);
+        std::copy(this->keys, this->keys + this->size, page->keys);
+        if(this->bottom){
+            std::copy(this->values, this->values + this->size, page->values);
+        } else {
+            for(int i=0; i<this->size; i++){
+                this->pages[i]->retain();
+            }
+            std::copy(this->pages, this->pages + this->size, page->pages);
+            std::copy(this->counts, this->counts + this->size, page->counts);
+            std::copy(this->summaries, this->summaries + this->size, page->summaries);
         }
+        page->size = this->size;
+        return page;
     }
 
     ~FlatPage(){
+        delete this->filter;
         delete[] this->keys;
         if(this->bottom){
             delete[] this->values;
         } else {
             if(this->pages != NULL)
                 for(int i=0; i<this->size; i++){
-                    delete this->pages[i];
+                    Page<Key, Value>::release(this->pages[i]);
                 }
             delete[] this->pages;
+            delete[] this->counts;
+            delete[] this->summaries;
         }
     }
 
 };
 
+template<class Key, class Value> Codec* FlatPage<Key, Value>::codec = NULL;
+template<class Key, class Value> int FlatPage<Key, Value>::filterBitsPerKey = 0;
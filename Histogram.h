@@ -0,0 +1,102 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+//Log-linear latency histogram in the style of HdrHistogram: values are
+//bucketed by power of two and each power is split into 2^precision linear
+//sub-buckets, so every recorded value keeps about 3 significant digits.
+class Histogram{
+private:
+    static const int PRECISION = 10;
+    static const int SUB_BUCKETS = 1 << PRECISION;
+    static const int POWERS = 64 - PRECISION;
+
+    std::vector<uint64_t> counts;
+    uint64_t total;
+    uint64_t minValue;
+    uint64_t maxValue;
+    double sum;
+
+    static int indexOf(uint64_t value){
+        if(value < SUB_BUCKETS)
+            return value;
+        int power = 63 - __builtin_clzll(value) - PRECISION + 1;
+        int sub = value >> power;
+        return power * SUB_BUCKETS + sub;
+    }
+
+    //largest value that maps to the bucket
+    static uint64_t valueAt(int index){
+        int power = index / SUB_BUCKETS;
+        uint64_t sub = index % SUB_BUCKETS;
+        if(power == 0)
+            return sub;
+        return ((sub + 1) << power) - 1;
+    }
+
+public:
+    Histogram(){
+        this->counts.assign((POWERS + 1) * SUB_BUCKETS, 0);
+        this->total = 0;
+        this->minValue = UINT64_MAX;
+        this->maxValue = 0;
+        this->sum = 0;
+    }
+
+    void record(uint64_t value){
+        this->counts[indexOf(value)]++;
+        this->total++;
+        this->sum += value;
+        if(value < this->minValue)
+            this->minValue = value;
+        if(value > this->maxValue)
+            this->maxValue = value;
+    }
+
+    void merge(const Histogram& other){
+        for(size_t i=0; i<this->counts.size(); i++){
+            this->counts[i] += other.counts[i];
+        }
+        this->total += other.total;
+        this->sum += other.sum;
+        if(other.minValue < this->minValue)
+            this->minValue = other.minValue;
+        if(other.maxValue > this->maxValue)
+            this->maxValue = other.maxValue;
+    }
+
+    //Value at the given percentile (0-100)
+    uint64_t percentile(double p) const{
+        if(this->total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)std::ceil(p / 100.0 * this->total);
+        if(rank < 1)
+            rank = 1;
+        uint64_t seen = 0;
+        for(size_t i=0; i<this->counts.size(); i++){
+            seen += this->counts[i];
+            if(seen >= rank){
+                uint64_t value = valueAt(i);
+                return value < this->maxValue ? value : this->maxValue;
+            }
+        }
+        return this->maxValue;
+    }
+
+    uint64_t count() const{
+        return this->total;
+    }
+
+    uint64_t min() const{
+        return this->total == 0 ? 0 : this->minValue;
+    }
+
+    uint64_t max() const{
+        return this->maxValue;
+    }
+
+    double mean() const{
+        return this->total == 0 ? 0 : this->sum / this->total;
+    }
+};
@@ -0,0 +1,104 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <random>
+
+//Key index streams for benchmarks and workload drivers, every generator
+//returns indexes in [0, n)
+class KeyGenerator{
+public:
+    virtual uint64_t next() = 0;
+    virtual ~KeyGenerator() {};
+};
+
+class SequentialGenerator : public KeyGenerator{
+private:
+    uint64_t counter;
+    uint64_t n;
+
+public:
+    SequentialGenerator(uint64_t n, uint64_t start = 0){
+        this->n = n;
+        this->counter = start;
+    }
+
+    uint64_t next(){
+        return this->counter++ % this->n;
+    }
+};
+
+class UniformGenerator : public KeyGenerator{
+private:
+    std::mt19937_64 gen;
+    std::uniform_int_distribution<uint64_t> dis;
+
+public:
+    UniformGenerator(uint64_t n, uint64_t seed = 1) : gen(seed), dis(0, n - 1){
+    }
+
+    uint64_t next(){
+        return this->dis(this->gen);
+    }
+};
+
+//Zipfian distribution from Gray et al., "Quickly generating billion-record
+//synthetic databases", as used by YCSB. Index 0 is the most popular unless
+//scrambled, which spreads the popular indexes over the whole range.
+class ZipfianGenerator : public KeyGenerator{
+private:
+    uint64_t n;
+    double theta;
+    double alpha;
+    double zetan;
+    double eta;
+    bool scrambled;
+    std::mt19937_64 gen;
+    std::uniform_real_distribution<double> dis;
+
+    static double zeta(uint64_t n, double theta){
+        double sum = 0;
+        for(uint64_t i=1; i<=n; i++){
+            sum += 1.0 / std::pow((double)i, theta);
+        }
+        return sum;
+    }
+
+    static uint64_t fnv(uint64_t v){
+        uint64_t h = 0xcbf29ce484222325ULL;
+        for(int i=0; i<8; i++){
+            h ^= v & 0xff;
+            h *= 0x100000001b3ULL;
+            v >>= 8;
+        }
+        return h;
+    }
+
+public:
+    static constexpr double THETA = 0.99;
+
+    ZipfianGenerator(uint64_t n, bool scrambled = true, double theta = THETA, uint64_t seed = 1) : gen(seed), dis(0.0, 1.0){
+        this->n = n;
+        this->theta = theta;
+        this->scrambled = scrambled;
+        this->zetan = zeta(n, theta);
+        this->alpha = 1.0 / (1.0 - theta);
+        double zeta2 = zeta(2, theta);
+        this->eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta2 / this->zetan);
+    }
+
+    uint64_t next(){
+        double u = this->dis(this->gen);
+        double uz = u * this->zetan;
+        uint64_t v;
+        if(uz < 1.0){
+            v = 0;
+        } else if(uz < 1.0 + std::pow(0.5, this->theta)){
+            v = 1;
+        } else {
+            v = (uint64_t)(this->n * std::pow(this->eta * u - this->eta + 1, this->alpha));
+        }
+        if(v >= this->n)
+            v = this->n - 1;
+        return this->scrambled ? fnv(v) % this->n : v;
+    }
+};
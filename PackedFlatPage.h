@@ -0,0 +1,359 @@
+#pragma once
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+
+#include "FlatPage.h"
+
+//Sorted integral keys stored frame-of-reference: every key is kept as its
+//distance from the first key, bit-packed at the width of the largest distance.
+template<class Key> class PackedKeys{
+private:
+    typedef typename std::make_unsigned<Key>::type Unsigned;
+
+    Key base;
+    unsigned int width;
+    unsigned int n;
+    std::vector<uint64_t> words;
+
+    uint64_t delta(Key key) const{
+        return (uint64_t)(Unsigned)((Unsigned)key - (Unsigned)this->base);
+    }
+
+    uint64_t deltaAt(unsigned int index) const{
+        if(this->width == 0)
+            return 0;
+        uint64_t bit = (uint64_t)index * this->width;
+        unsigned int word = bit >> 6;
+        unsigned int offset = bit & 63;
+        uint64_t v = this->words[word] >> offset;
+        if(offset + this->width > 64){
+            v |= this->words[word + 1] << (64 - offset);
+        }
+        if(this->width < 64){
+            v &= ((uint64_t)1 << this->width) - 1;
+        }
+        return v;
+    }
+
+public:
+    PackedKeys(){
+        this->base = Key();
+        this->width = 0;
+        this->n = 0;
+    }
+
+    void encode(const Key* keys, unsigned int n){
+        this->n = n;
+        this->base = n > 0 ? keys[0] : Key();
+        uint64_t maxDelta = n > 0 ? this->delta(keys[n - 1]) : 0;
+        this->width = 0;
+        while(this->width < 64 && (maxDelta >> this->width) != 0){
+            this->width++;
+        }
+        this->words.assign(((uint64_t)n * this->width + 63) / 64, 0);
+        for(unsigned int i=0; i<n; i++){
+            uint64_t v = this->delta(keys[i]);
+            uint64_t bit = (uint64_t)i * this->width;
+            unsigned int word = bit >> 6;
+            unsigned int offset = bit & 63;
+            if(this->width == 0)
+                continue;
+            this->words[word] |= v << offset;
+            if(offset + this->width > 64){
+                this->words[word + 1] |= v >> (64 - offset);
+            }
+        }
+    }
+
+    void decode(Key* keys) const{
+        for(unsigned int i=0; i<this->n; i++){
+            keys[i] = this->at(i);
+        }
+    }
+
+    Key at(unsigned int index) const{
+        return (Key)(Unsigned)((Unsigned)this->base + (Unsigned)this->deltaAt(index));
+    }
+
+    unsigned int count() const{
+        return this->n;
+    }
+
+    unsigned int bitsPerKey() const{
+        return this->width;
+    }
+
+    const uint64_t* data() const{
+        return this->words.data();
+    }
+
+    size_t bytes() const{
+        return this->words.size() * sizeof(uint64_t);
+    }
+
+    //Index of the key, -1 if it is not present
+    int find(Key key) const{
+        int index = this->floor(key);
+        if(index >= 0 && this->at(index) == key)
+            return index;
+        return -1;
+    }
+
+    //Index of the largest key not greater than key, -1 if there is none
+    int floor(Key key) const{
+        if(this->n == 0 || key < this->base)
+            return -1;
+        uint64_t d = this->delta(key);
+        int first = 0;
+        int last = this->n - 1;
+        while(first <= last){
+            int mid = first + (last - first) / 2;
+            uint64_t m = this->deltaAt(mid);
+            if (m == d) {
+                return mid;
+            }
+            if (m < d) {
+                first = mid + 1;
+            } else {
+                last = mid - 1;
+            }
+        }
+        return last;
+    }
+
+    void write(std::ostream& file) const{
+        file.write((char*)&this->n, sizeof(this->n));
+        file.write((char*)&this->base, sizeof(this->base));
+        file.write((char*)&this->width, sizeof(this->width));
+        file.write((char*)this->words.data(), this->words.size() * sizeof(uint64_t));
+    }
+
+    //False if the header claims more than maxCount keys or an impossible
+    //width, which is checked before anything is allocated for them
+    bool read(std::istream& file, unsigned int maxCount){
+        file.read((char*)&this->n, sizeof(this->n));
+        file.read((char*)&this->base, sizeof(this->base));
+        file.read((char*)&this->width, sizeof(this->width));
+        if(!file || this->n > maxCount || this->width > 64){
+            this->n = 0;
+            this->width = 0;
+            this->words.clear();
+            return false;
+        }
+        this->words.assign(((uint64_t)this->n * this->width + 63) / 64, 0);
+        file.read((char*)this->words.data(), this->words.size() * sizeof(uint64_t));
+        return true;
+    }
+};
+
+//FlatPage for integral keys whose leaves are saved with packed keys. A leaf
+//loaded from disk searches the packed keys directly and only expands them to
+//a full width array on its first modification.
+template<class Key, class Value> class PackedFlatPage : public FlatPage<Key, Value>{
+    static_assert(std::is_integral<Key>::value, "PackedFlatPage needs integral keys");
+private:
+    PackedKeys<Key> packed;
+    bool packedOnly;
+
+    void unpack(){
+        this->open();
+        if(!this->packedOnly)
+            return;
+        this->keys = new Key[2*this->order];
+        this->packed.decode(this->keys);
+        this->packed = PackedKeys<Key>();
+        this->packedOnly = false;
+    }
+
+public:
+    PackedFlatPage(int order, bool bottom):FlatPage<Key, Value>(order, bottom){
+        this->packedOnly = false;
+    }
+
+    PackedFlatPage(const std::string& id, int order):FlatPage<Key, Value>(id, order){
+        this->packedOnly = false;
+    }
+
+    PackedFlatPage* newPassivePage(const std::string& id){
+        return new PackedFlatPage(id, this->order);
+    }
+
+    PackedFlatPage* newPage(bool bottom){
+        return new PackedFlatPage(this->order, bottom);
+    }
+
+    void store(std::ostream& file, std::ostream& metafile){
+        if(!this->bottom){
+            FlatPage<Key, Value>::store(file, metafile);
+            return;
+        }
+        if(this->packedOnly){
+            this->packed.write(file);
+        } else {
+            PackedKeys<Key> keys;
+            keys.encode(this->keys, this->size);
+            keys.write(file);
+        }
+        file.write((char*)this->values, this->size * sizeof(Value));
+    }
+
+    void load(std::istream& file, std::istream& metafile){
+        if(!this->bottom){
+            FlatPage<Key, Value>::load(file, metafile);
+            return;
+        }
+        if(!this->packed.read(file, 2*this->order)){
+            std::cout << "Error: page " << this->id << " has corrupt packed keys" << std::endl;
+            assert(false);
+        }
+        this->packedOnly = true;
+        this->size = this->packed.count();
+        this->values = new Value[2*this->order];
+        file.read((char*)this->values, this->size * sizeof(Value));
+    }
+
+    //Drops the full width keys of a leaf in favour of the packed form
+    void pack(){
+        this->open();
+        if(!this->bottom || this->packedOnly)
+            return;
+        this->packed.encode(this->keys, this->size);
+        delete[] this->keys;
+        this->keys = NULL;
+        this->packedOnly = true;
+    }
+
+    //a packed leaf is expanded into the copy, the shared original is
+    //left as it is
+    PackedFlatPage* clone(){
+        this->open();
+        if(!this->packedOnly)
+            return (PackedFlatPage*)FlatPage<Key, Value>::clone();
+        PackedFlatPage* page = this->newPage(true);
+        this->packed.decode(page->keys);
+        std::copy(this->values, this->values + this->size, page->values);
+        page->size = this->size;
+        return page;
+    }
+
+    bool close(){
+        if(!FlatPage<Key, Value>::close())
+            return false;
+        this->packed = PackedKeys<Key>();
+        this->packedOnly = false;
+        return true;
+    }
+
+    bool isPacked(){
+        return this->packedOnly;
+    }
+
+    //A packed leaf has no key array, its search runs over the packed words
+    void prefetch(){
+        if(!this->is_open || !this->packedOnly){
+            FlatPage<Key, Value>::prefetch();
+            return;
+        }
+        const char* begin = (const char*)this->packed.data();
+        size_t bytes = this->packed.bytes();
+        for(size_t offset=0; offset<bytes && offset<FlatPage<Key, Value>::PREFETCH_BYTES; offset+=64){
+            __builtin_prefetch(begin + offset);
+        }
+    }
+
+    Value* getValue(Key key){
+        this->open();
+        if(!this->packedOnly)
+            return FlatPage<Key, Value>::getValue(key);
+        int index = this->packed.find(key);
+        if(index < 0)
+            return NULL;
+        return &this->values[index];
+    }
+
+    int getIndexOf(Key key){
+        this->open();
+        if(!this->packedOnly)
+            return FlatPage<Key, Value>::getIndexOf(key);
+        return this->packed.floor(key);
+    }
+
+    Key getKeyAt(int index){
+        this->open();
+        if(!this->packedOnly)
+            return FlatPage<Key, Value>::getKeyAt(index);
+        return this->packed.at(index);
+    }
+
+    Key firstKey(){
+        return this->getKeyAt(0);
+    }
+
+    Key lastKey(){
+        return this->getKeyAt(this->count() - 1);
+    }
+
+    Key secondKey(){
+        return this->getKeyAt(1);
+    }
+
+    void add(Key key, Value value){
+        this->unpack();
+        FlatPage<Key, Value>::add(key, value);
+    }
+
+    void add(Key key, Page<Key, Value>* page){
+        FlatPage<Key, Value>::add(key, page);
+    }
+
+    Value* findOrAdd(Key key, const Value& value, bool& inserted){
+        this->unpack();
+        return FlatPage<Key, Value>::findOrAdd(key, value, inserted);
+    }
+
+    unsigned int addSorted(const std::pair<Key, Value>* entries, unsigned int n, unsigned int limit, unsigned int& inserted){
+        this->unpack();
+        return FlatPage<Key, Value>::addSorted(entries, n, limit, inserted);
+    }
+
+    using FlatPage<Key, Value>::split;
+
+    FlatPage<Key, Value>* split(unsigned int at){
+        this->unpack();
+        return FlatPage<Key, Value>::split(at);
+    }
+
+    Page<Key, Value>* merge(Page<Key, Value>* page){
+        this->unpack();
+        ((PackedFlatPage*)page)->unpack();
+        return FlatPage<Key, Value>::merge(page);
+    }
+
+    void remove(Key key){
+        this->unpack();
+        FlatPage<Key, Value>::remove(key);
+    }
+
+    void removeAt(unsigned int index, unsigned int entries){
+        this->unpack();
+        FlatPage<Key, Value>::removeAt(index, entries);
+    }
+
+    void replaceKey(Key oldKey, Key newKey){
+        this->unpack();
+        FlatPage<Key, Value>::replaceKey(oldKey, newKey);
+    }
+
+    void print(){
+        if(this->is_open)
+            this->unpack();
+        FlatPage<Key, Value>::print();
+    }
+
+    void printKeys(){
+        if(this->is_open)
+            this->unpack();
+        FlatPage<Key, Value>::printKeys();
+    }
+};
@@ -1,17 +1,50 @@
 #pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 
 //Interface for Btree pages
 template<class Key, class Value> class Page{
 public:
+    //count of a child whose subtree has not been counted
+    static const uint64_t UNCOUNTED = ~(uint64_t)0;
+
+    Page() : references(1) {}
+
+    //A page is shared by a tree and its snapshots: every parent and every
+    //tree whose root it is holds one reference, the last one deletes it
+    void retain(){
+        this->references.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void release(Page* page){
+        if(page->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            delete page;
+    }
+
+    //a shared page must not be modified, it is cloned instead
+    bool isShared() const{
+        return this->references.load(std::memory_order_acquire) > 1;
+    }
+
     virtual std::string getId() const = 0;
     virtual Value* getValue(Key key) = 0;
     virtual int getIndexOf(Key key) = 0;
     virtual Value* getValueAt(int index) = 0;
     virtual Key getKeyAt(int index) = 0;
     virtual Page* getPageAt(int index) = 0;
+    //replaces the child at index, the old child is not released
+    virtual void setPageAt(int index, Page* page) = 0;
+    //number of leaf entries under the child at index, or UNCOUNTED
+    virtual uint64_t getCountAt(int index) = 0;
+    virtual void setCountAt(int index, uint64_t count) = 0;
+    //summary of the values under the child at index, see Summary.h
+    virtual Value* getSummaryAt(int index) = 0;
+    virtual void setSummaryAt(int index, const Value& summary) = 0;
     virtual Key firstKey() = 0;
     virtual Key lastKey() = 0;
     virtual Key secondKey() = 0;
@@ -22,6 +55,14 @@ public:
     virtual bool isExternal() = 0;
     virtual bool isFull() = 0;
     virtual Page* next(Key key) = 0;
+    //false only if the key is certainly not stored in this page
+    virtual bool mayContain(Key /*key*/) { return true; }
+    //hint that the page will be needed soon
+    virtual void prefetch() {}
+    //false for pages known only by id that have not been loaded yet
+    virtual bool isOpen() { return true; }
+    //releases the memory of a clean page, false if it has to stay loaded
+    virtual bool close() { return false; }
     virtual void printKeys() = 0;
     virtual void print() = 0;
     virtual void draw(std::ofstream &file) {
@@ -47,16 +88,41 @@ public:
 
     virtual void add(Key key, Value value) = 0;
     virtual void add(Key key, Page* page) = 0;
+    //slot of the value of key in a leaf for an in-place update, the key is
+    //added with value first if it is missing. Marks the page modified
+    virtual Value* findOrAdd(Key key, const Value& value, bool& inserted) = 0;
+    //merges sorted entries with distinct keys into a leaf until it holds
+    //limit entries, returns how many were taken and counts the new keys
+    virtual unsigned int addSorted(const std::pair<Key, Value>* entries, unsigned int n, unsigned int limit, unsigned int& inserted) = 0;
     virtual Page* split() = 0;
+    //moves the entries from index at onwards to a new page
+    virtual Page* split(unsigned int at) = 0;
     virtual Page* merge(Page* page) = 0;
     virtual void remove(Key key) = 0;
+    //removes the entries from index on, the children of an internal page
+    //are not deleted
+    virtual void removeAt(unsigned int index, unsigned int entries) = 0;
     virtual void replaceKey(Key oldKey, Key newKey) = 0;
     virtual void detach() = 0;
+    //modifiable copy of the page with a new id that shares the children
+    virtual Page* clone() = 0;
 
     virtual void save() = 0;
+    //save that writes a changed page already on disk under a new id, the
+    //old ids are added to relocated
+    virtual void save(std::vector<std::string>* relocated) = 0;
+    //The two halves of a save: collect settles the ids of the changed pages
+    //of the subtree and lists them, write then writes one of them. The
+    //listed pages can be written in any order and at the same time
+    virtual void collect(std::vector<std::string>* relocated, std::vector<Page*>& writes) = 0;
+    virtual void write() = 0;
     virtual void open(bool reload=false) = 0;
     virtual ~Page() {};
+
+private:
+    std::atomic<unsigned int> references;
 };
 
 #define SAVE if(this->filename != "") this->save(this->filename);
 
+template<class Key, class Value> const uint64_t Page<Key, Value>::UNCOUNTED;
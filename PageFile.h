@@ -0,0 +1,163 @@
+#pragma once
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Codec.h"
+#include "Crc32c.h"
+#include "Stats.h"
+
+//On-disk envelope shared by all page files: a small header naming the codec
+//the payload was stored with and the CRC32C of the header and the stored
+//bytes, followed by the (possibly compressed) payload. Files written before
+//the envelope are the bare payload and are read as such.
+class PageFile{
+private:
+    //files written before checksums have no checksum after the header
+    static const uint32_t MAGIC = 0x5844594d; // "MYDX"
+    static const uint32_t CHECKED_MAGIC = 0x4358594d; // "MYXC"
+
+    struct Header{
+        uint32_t magic;
+        uint32_t rawSize;
+        uint32_t storedSize;
+        unsigned char codec;
+        unsigned char reserved[3];
+    };
+
+    static bool& syncing(){
+        static bool sync = false;
+        return sync;
+    }
+
+public:
+    //With sync, every file written is flushed to the device before write
+    //returns, so a save survives a power failure and not only a crash of
+    //the process. Off by default
+    static void setSync(bool sync){
+        PageFile::syncing() = sync;
+    }
+
+    static bool isSync(){
+        return PageFile::syncing();
+    }
+
+    //Flushes a written file to the device if sync is on
+    static bool sync(const std::string& path){
+        if(!PageFile::syncing())
+            return true;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        bool ok = ::fsync(fd) == 0;
+        ::close(fd);
+        return ok;
+    }
+
+    //Flushes the directory entries of the files created next to path
+    static bool syncDirectory(const std::string& path){
+        size_t slash = path.find_last_of('/');
+        return PageFile::sync(slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash));
+    }
+
+    static bool exists(const std::string& path){
+        std::ifstream file(path);
+        return file.is_open();
+    }
+
+    static bool write(const std::string& path, const std::string& payload, Codec* codec){
+        if(codec == NULL)
+            codec = Codec::forTag(RawCodec::TAG);
+
+        std::string stored;
+        codec->compress(payload.data(), payload.size(), stored);
+        //incompressible pages are kept raw
+        if(stored.size() >= payload.size() && codec->tag() != RawCodec::TAG){
+            codec = Codec::forTag(RawCodec::TAG);
+            stored = payload;
+        }
+
+        Header header;
+        memset(&header, 0, sizeof(header));
+        header.magic = CHECKED_MAGIC;
+        header.rawSize = payload.size();
+        header.storedSize = stored.size();
+        header.codec = codec->tag();
+        uint32_t checksum = Crc32c::compute(&header, sizeof(header));
+        checksum = Crc32c::compute(stored.data(), stored.size(), checksum);
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if(!file.is_open()){
+            std::cout << "Error: could not write " << path << std::endl;
+            return false;
+        }
+        file.write((char*)&header, sizeof(header));
+        file.write((char*)&checksum, sizeof(checksum));
+        file.write(stored.data(), stored.size());
+        Stats::add(Stats::BYTES_WRITTEN, sizeof(header) + sizeof(checksum) + stored.size());
+        file.close();
+        return file.good() && PageFile::sync(path);
+    }
+
+    static bool read(const std::string& path, std::string& payload){
+        std::ifstream file(path, std::ios::binary);
+        if(!file.is_open())
+            return false;
+
+        Header header;
+        file.read((char*)&header, sizeof(header));
+        if(file.gcount() != sizeof(header) || (header.magic != MAGIC && header.magic != CHECKED_MAGIC)){
+            //no envelope, the file is a raw payload of the original layout
+            file.clear();
+            file.seekg(0, std::ios::end);
+            uint64_t size = file.tellg();
+            file.seekg(0);
+            payload.assign(size, '\0');
+            file.read(&payload[0], size);
+            Stats::add(Stats::BYTES_READ, file.gcount());
+            return (uint64_t)file.gcount() == size;
+        }
+        bool checked = header.magic == CHECKED_MAGIC;
+        uint32_t checksum = 0;
+        if(checked)
+            file.read((char*)&checksum, sizeof(checksum));
+        Codec* codec = Codec::forTag(header.codec);
+        if(codec == NULL){
+            std::cout << "Error: unknown codec " << (int)header.codec << " in " << path << std::endl;
+            return false;
+        }
+
+        //the sizes are checked against the file before anything is
+        //allocated for them, the checksum comes after the allocation
+        uint64_t offset = sizeof(header) + (checked ? sizeof(checksum) : 0);
+        file.clear();
+        file.seekg(0, std::ios::end);
+        uint64_t size = file.tellg();
+        file.seekg(offset);
+        if(size < offset || header.storedSize > size - offset || header.rawSize > codec->maxRawSize(header.storedSize)){
+            std::cout << "Error: " << path << " has a corrupt header" << std::endl;
+            return false;
+        }
+
+        std::string stored(header.storedSize, '\0');
+        file.read(&stored[0], header.storedSize);
+        Stats::add(Stats::BYTES_READ, sizeof(header) + (checked ? sizeof(checksum) : 0) + file.gcount());
+        if(file.gcount() != header.storedSize){
+            std::cout << "Error: " << path << " is truncated" << std::endl;
+            return false;
+        }
+        if(checked && checksum != Crc32c::compute(stored.data(), stored.size(), Crc32c::compute(&header, sizeof(header)))){
+            std::cout << "Error: " << path << " does not match its checksum" << std::endl;
+            return false;
+        }
+        payload.resize(header.rawSize);
+        if(!codec->decompress(stored.data(), stored.size(), &payload[0], header.rawSize)){
+            std::cout << "Error: " << path << " failed to decompress" << std::endl;
+            return false;
+        }
+        return true;
+    }
+};
@@ -0,0 +1,150 @@
+#pragma once
+#include <map>
+#include <string>
+#include <mutex>
+#include <condition_variable>
+
+#include "PageFile.h"
+#include "ThreadPool.h"
+
+//Reads page files in the background so that a later open() finds them in
+//memory. Pages are keyed by id; the bytes are handed over once and dropped.
+class Prefetcher{
+private:
+    struct Entry{
+        bool done;
+        bool ok;
+        bool bottom;
+        //dropped while the read was in flight, the read discards it
+        bool dropped;
+        std::string data;
+        std::string meta;
+    };
+
+    std::map<std::string, Entry> entries;
+    std::mutex mutex;
+    std::condition_variable loaded;
+    ThreadPool* pool;
+    int threads;
+
+    Prefetcher(){
+        this->pool = NULL;
+        this->threads = 4;
+    }
+
+    void read(const std::string& id){
+        Entry entry;
+        entry.done = true;
+        entry.dropped = false;
+        if(PageFile::exists(id + ".idx")){
+            entry.bottom = false;
+            entry.ok = PageFile::read(id + ".idx", entry.data) && PageFile::read(id + ".meta.idx", entry.meta);
+        } else {
+            entry.bottom = true;
+            entry.ok = PageFile::read(id + ".values.idx", entry.data);
+        }
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            std::map<std::string, Entry>::iterator it = this->entries.find(id);
+            if(it != this->entries.end() && it->second.dropped)
+                this->entries.erase(it);
+            else if(it != this->entries.end())
+                it->second = std::move(entry);
+        }
+        this->loaded.notify_all();
+    }
+
+public:
+    static Prefetcher& instance(){
+        static Prefetcher prefetcher;
+        return prefetcher;
+    }
+
+    //Number of reader threads, takes effect before the first prefetch
+    void setThreads(int threads){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->threads = threads;
+    }
+
+    void prefetch(const std::string& id){
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            std::map<std::string, Entry>::iterator it = this->entries.find(id);
+            if(it != this->entries.end()){
+                it->second.dropped = false;
+                return;
+            }
+            Entry& entry = this->entries[id];
+            entry.done = false;
+            entry.dropped = false;
+            entry.ok = false;
+            entry.bottom = false;
+            if(this->pool == NULL)
+                this->pool = new ThreadPool(this->threads);
+        }
+        this->pool->submit([this, id]{ this->read(id); });
+    }
+
+    //Hands over the files of a prefetched page, waiting if the read is still
+    //in flight. Returns false if the page was never prefetched.
+    bool take(const std::string& id, bool& bottom, std::string& data, std::string& meta, bool& ok){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        std::map<std::string, Entry>::iterator it = this->entries.find(id);
+        if(it == this->entries.end() || it->second.dropped)
+            return false;
+        //a drop during the wait erases the entry once its read is done
+        this->loaded.wait(lock, [this, &it, &id]{
+            it = this->entries.find(id);
+            return it == this->entries.end() || it->second.done;
+        });
+        if(it == this->entries.end())
+            return false;
+        bottom = it->second.bottom;
+        ok = it->second.ok;
+        data = std::move(it->second.data);
+        meta = std::move(it->second.meta);
+        this->entries.erase(it);
+        return true;
+    }
+
+    //Drops what was read of a page nobody will take, a read still in flight
+    //is discarded when it finishes
+    void drop(const std::string& id){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        std::map<std::string, Entry>::iterator it = this->entries.find(id);
+        if(it == this->entries.end())
+            return;
+        if(it->second.done)
+            this->entries.erase(it);
+        else
+            it->second.dropped = true;
+    }
+
+    //Number of pages read or being read that are still to be taken
+    size_t size(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        size_t pending = 0;
+        for(std::map<std::string, Entry>::iterator it = this->entries.begin(); it != this->entries.end(); it++){
+            if(!it->second.dropped)
+                pending++;
+        }
+        return pending;
+    }
+
+    //Waits for outstanding reads and drops everything not taken yet
+    void clear(){
+        ThreadPool* pool;
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            pool = this->pool;
+        }
+        if(pool != NULL)
+            pool->wait();
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->entries.clear();
+    }
+
+    ~Prefetcher(){
+        delete this->pool;
+    }
+};
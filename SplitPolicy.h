@@ -0,0 +1,14 @@
+#pragma once
+
+//Where Btree splits a full leaf. Every policy splits in the middle unless
+//the key that filled the leaf went to its end: then APPEND_90 keeps 90% of
+//the entries on the left and APPEND_100 all but the last one, so leaves
+//filled by ascending keys stay (nearly) full. Internal pages always split
+//in the middle. ADAPTIVE splits like
+//APPEND_100 only while the recent puts have been ascending.
+enum SplitPolicy{
+    SPLIT_MIDDLE,
+    SPLIT_APPEND_90,
+    SPLIT_APPEND_100,
+    SPLIT_ADAPTIVE
+};
@@ -0,0 +1,199 @@
+#pragma once
+#include <atomic>
+#include <algorithm>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdint>
+
+//Operation and I/O counters. Every thread increments its own block of
+//relaxed atomics, so counting never contends; collect() sums the blocks of
+//all threads. The counters are process wide, Btree::stats() adds the shape
+//of one tree to them.
+struct Stats{
+    enum Counter{
+        GETS,
+        PUTS,
+        DELETES,
+        PAGE_LOADS,
+        PREFETCHED_LOADS,
+        PAGE_WRITES,
+        BYTES_READ,
+        BYTES_WRITTEN,
+        SPLITS,
+        MERGES,
+        ROOT_SPLITS,
+        ROOT_MERGES,
+        FILTER_PROBES,
+        FILTER_NEGATIVES,
+        COUNTERS
+    };
+
+    uint64_t gets;
+    uint64_t puts;
+    uint64_t deletes;
+    uint64_t pageLoads;
+    uint64_t prefetchedLoads;
+    uint64_t pageWrites;
+    uint64_t bytesRead;
+    uint64_t bytesWritten;
+    uint64_t splits;
+    uint64_t merges;
+    uint64_t rootSplits;
+    uint64_t rootMerges;
+    uint64_t filterProbes;
+    uint64_t filterNegatives;
+
+    //filled in by Btree::stats()
+    unsigned int height;
+    uint64_t keys;
+    uint64_t residentPages;
+    double averageFill;
+
+    static void add(Counter counter, uint64_t n = 1){
+        local().values[counter].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static Stats collect(){
+        uint64_t sums[COUNTERS] = {0};
+        {
+            std::lock_guard<std::mutex> guard(registryMutex());
+            std::vector<Block*>& all = blocks();
+            for(size_t b=0; b<all.size(); b++){
+                for(int c=0; c<COUNTERS; c++){
+                    sums[c] += all[b]->values[c].load(std::memory_order_relaxed);
+                }
+            }
+            for(int c=0; c<COUNTERS; c++){
+                sums[c] += retired().values[c].load(std::memory_order_relaxed);
+            }
+        }
+        Stats stats;
+        stats.gets = sums[GETS];
+        stats.puts = sums[PUTS];
+        stats.deletes = sums[DELETES];
+        stats.pageLoads = sums[PAGE_LOADS];
+        stats.prefetchedLoads = sums[PREFETCHED_LOADS];
+        stats.pageWrites = sums[PAGE_WRITES];
+        stats.bytesRead = sums[BYTES_READ];
+        stats.bytesWritten = sums[BYTES_WRITTEN];
+        stats.splits = sums[SPLITS];
+        stats.merges = sums[MERGES];
+        stats.rootSplits = sums[ROOT_SPLITS];
+        stats.rootMerges = sums[ROOT_MERGES];
+        stats.filterProbes = sums[FILTER_PROBES];
+        stats.filterNegatives = sums[FILTER_NEGATIVES];
+        stats.height = 0;
+        stats.keys = 0;
+        stats.residentPages = 0;
+        stats.averageFill = 0;
+        return stats;
+    }
+
+    static void reset(){
+        std::lock_guard<std::mutex> guard(registryMutex());
+        std::vector<Block*>& all = blocks();
+        for(size_t b=0; b<all.size(); b++){
+            for(int c=0; c<COUNTERS; c++){
+                all[b]->values[c].store(0, std::memory_order_relaxed);
+            }
+        }
+        for(int c=0; c<COUNTERS; c++){
+            retired().values[c].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    std::string toJson() const{
+        std::ostringstream json;
+        json << "{\"gets\": " << this->gets
+             << ", \"puts\": " << this->puts
+             << ", \"deletes\": " << this->deletes
+             << ", \"pageLoads\": " << this->pageLoads
+             << ", \"prefetchedLoads\": " << this->prefetchedLoads
+             << ", \"pageWrites\": " << this->pageWrites
+             << ", \"bytesRead\": " << this->bytesRead
+             << ", \"bytesWritten\": " << this->bytesWritten
+             << ", \"splits\": " << this->splits
+             << ", \"merges\": " << this->merges
+             << ", \"rootSplits\": " << this->rootSplits
+             << ", \"rootMerges\": " << this->rootMerges
+             << ", \"filterProbes\": " << this->filterProbes
+             << ", \"filterNegatives\": " << this->filterNegatives
+             << ", \"height\": " << this->height
+             << ", \"keys\": " << this->keys
+             << ", \"residentPages\": " << this->residentPages
+             << ", \"averageFill\": " << this->averageFill
+             << "}";
+        return json.str();
+    }
+
+private:
+    struct Block{
+        std::atomic<uint64_t> values[COUNTERS];
+
+        static Block* create(){
+            Block* block = new Block();
+            for(int c=0; c<COUNTERS; c++){
+                block->values[c].store(0, std::memory_order_relaxed);
+            }
+            return block;
+        }
+    };
+
+    //The registry is never destroyed: pool threads may still exit while
+    //static objects are torn down
+    static std::mutex& registryMutex(){
+        static std::mutex* mutex = new std::mutex();
+        return *mutex;
+    }
+
+    //blocks of the running threads
+    static std::vector<Block*>& blocks(){
+        static std::vector<Block*>* all = new std::vector<Block*>();
+        return *all;
+    }
+
+    //counts of the threads that have exited
+    static Block& retired(){
+        static Block* block = Block::create();
+        return *block;
+    }
+
+    static Block* newBlock(){
+        Block* block = Block::create();
+        std::lock_guard<std::mutex> guard(registryMutex());
+        blocks().push_back(block);
+        return block;
+    }
+
+    //Folds the block of an exiting thread into the retired counts, so
+    //threads that come and go keep neither memory nor collect() growing
+    static void retire(Block* block){
+        {
+            std::lock_guard<std::mutex> guard(registryMutex());
+            for(int c=0; c<COUNTERS; c++){
+                retired().values[c].fetch_add(block->values[c].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+            std::vector<Block*>& all = blocks();
+            all.erase(std::find(all.begin(), all.end(), block));
+        }
+        delete block;
+    }
+
+    struct Owner{
+        Block* block;
+
+        Owner() : block(newBlock()){
+        }
+
+        ~Owner(){
+            retire(this->block);
+        }
+    };
+
+    static Block& local(){
+        thread_local Owner owner;
+        return *owner.block;
+    }
+};
@@ -0,0 +1,42 @@
+#pragma once
+#include <limits>
+#include <algorithm>
+
+//Summary policies for Btree. A policy is a monoid over values: identity()
+//summarizes no values and combine() joins the summaries of two runs of keys,
+//the left one first. Internal pages keep the summary of every child so that
+//Btree::aggregate only searches the two ends of a range. name() is saved
+//with the tree, so a tree reopened with another policy is summarized again.
+
+//Default policy: no summaries are kept
+template<class Value> struct NoSummary{
+    static const bool ENABLED = false;
+
+    static const char* name(){ return "none"; }
+    static Value identity(){ return Value(); }
+    static Value combine(const Value& a, const Value& /*b*/){ return a; }
+};
+
+template<class Value> struct SumSummary{
+    static const bool ENABLED = true;
+
+    static const char* name(){ return "sum"; }
+    static Value identity(){ return Value(); }
+    static Value combine(const Value& a, const Value& b){ return a + b; }
+};
+
+template<class Value> struct MinSummary{
+    static const bool ENABLED = true;
+
+    static const char* name(){ return "min"; }
+    static Value identity(){ return std::numeric_limits<Value>::max(); }
+    static Value combine(const Value& a, const Value& b){ return std::min(a, b); }
+};
+
+template<class Value> struct MaxSummary{
+    static const bool ENABLED = true;
+
+    static const char* name(){ return "max"; }
+    static Value identity(){ return std::numeric_limits<Value>::lowest(); }
+    static Value combine(const Value& a, const Value& b){ return std::max(a, b); }
+};
@@ -0,0 +1,135 @@
+#pragma once
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+
+#include "Crc32c.h"
+#include "PageFile.h"
+
+//Commit record of a saved tree. The pages of a save go to new files and
+//the superblock naming their root is written last, alternating between
+//<name>.super.0.idx and <name>.super.1.idx. The tree is the superblock with
+//the higher sequence number among those whose checksum matches, so a save
+//cut short leaves the previous one in place.
+struct Superblock{
+    uint64_t sequence;
+    int order;
+    int height;
+    int n;
+    std::string rootId;
+    bool counting;
+    std::string summary;
+
+    Superblock() : sequence(0), order(0), height(0), n(0), counting(false), summary("none") {}
+
+    static std::string path(const std::string& name, int slot){
+        return name + ".super." + std::to_string(slot) + ".idx";
+    }
+
+    //The lines of the legacy meta file, which the superblock starts with
+    //its sequence number
+    std::string fields() const{
+        std::ostringstream out;
+        out << this->order << std::endl;
+        out << this->height << std::endl;
+        out << this->n << std::endl;
+        out << this->rootId << std::endl;
+        out << this->counting << std::endl;
+        out << this->summary << std::endl;
+        return out.str();
+    }
+
+    bool parse(const std::string& data){
+        std::istringstream in(data);
+        if(!(in >> this->order >> this->height >> this->n >> this->rootId))
+            return false;
+        //meta files saved before subtree counts and summaries have no such
+        //lines
+        if(!(in >> this->counting))
+            this->counting = false;
+        if(!(in >> this->summary))
+            this->summary = "none";
+        return true;
+    }
+
+    bool write(const std::string& name) const{
+        std::string path = Superblock::path(name, this->sequence % 2);
+        std::ostringstream data;
+        data << this->sequence << std::endl << this->fields();
+        std::string content = data.str();
+        std::ofstream file(path, std::ios::trunc);
+        if(!file.is_open()){
+            std::cout << "Error: could not write " << path << std::endl;
+            return false;
+        }
+        file << content << std::hex << Crc32c::compute(content.data(), content.size()) << std::endl;
+        file.close();
+        return file.good() && PageFile::sync(path) && PageFile::syncDirectory(path);
+    }
+
+    //False if the file is missing or was not written completely
+    bool read(const std::string& path){
+        std::ifstream file(path);
+        if(!file.is_open())
+            return false;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        std::string data = buffer.str();
+        //the checksum is the last line
+        if(data.size() < 2 || data[data.size() - 1] != '\n')
+            return false;
+        size_t last = data.find_last_of('\n', data.size() - 2);
+        if(last == std::string::npos)
+            return false;
+        std::string content = data.substr(0, last + 1);
+        char* end;
+        unsigned long crc = std::strtoul(data.c_str() + last + 1, &end, 16);
+        if(*end != '\n' || crc != Crc32c::compute(content.data(), content.size()))
+            return false;
+        std::istringstream in(content);
+        if(!(in >> this->sequence))
+            return false;
+        return this->parse(content.substr(in.tellg()));
+    }
+
+    //Legacy <name>.meta.idx, the only record of trees saved before
+    //superblocks
+    bool readMeta(const std::string& name){
+        std::ifstream file(name + ".meta.idx");
+        if(!file.is_open())
+            return false;
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        this->sequence = 0;
+        return this->parse(buffer.str());
+    }
+
+    //The newest intact superblock of name, or its meta file
+    static bool load(const std::string& name, Superblock& super){
+        Superblock slots[2];
+        bool valid[2];
+        for(int slot=0; slot<2; slot++){
+            valid[slot] = slots[slot].read(Superblock::path(name, slot));
+        }
+        if(valid[0] || valid[1]){
+            int newest = !valid[0] || (valid[1] && slots[0].sequence < slots[1].sequence) ? 1 : 0;
+            super = slots[newest];
+            return true;
+        }
+        return super.readMeta(name);
+    }
+
+    //Sequence number of the newest intact superblock of name, 0 if none
+    static uint64_t latest(const std::string& name){
+        uint64_t sequence = 0;
+        for(int slot=0; slot<2; slot++){
+            Superblock super;
+            if(super.read(Superblock::path(name, slot)) && sequence < super.sequence)
+                sequence = super.sequence;
+        }
+        return sequence;
+    }
+};
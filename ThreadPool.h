@@ -0,0 +1,81 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+//Fixed set of worker threads draining a shared task queue
+class ThreadPool{
+private:
+    std::vector<std::thread> workers;
+    std::deque<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable available;
+    std::condition_variable finished;
+    int running;
+    bool stopping;
+
+    void work(){
+        while(true){
+            std::function<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->available.wait(lock, [this]{ return this->stopping || !this->tasks.empty(); });
+                if(this->tasks.empty())
+                    return;
+                task = std::move(this->tasks.front());
+                this->tasks.pop_front();
+                this->running++;
+            }
+            task();
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->running--;
+                if(this->running == 0 && this->tasks.empty())
+                    this->finished.notify_all();
+            }
+        }
+    }
+
+public:
+    ThreadPool(int threads){
+        this->running = 0;
+        this->stopping = false;
+        if(threads < 1)
+            threads = 1;
+        for(int i=0; i<threads; i++){
+            this->workers.push_back(std::thread(&ThreadPool::work, this));
+        }
+    }
+
+    void submit(std::function<void()> task){
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->tasks.push_back(std::move(task));
+        }
+        this->available.notify_one();
+    }
+
+    //Blocks until every submitted task has run
+    void wait(){
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->finished.wait(lock, [this]{ return this->running == 0 && this->tasks.empty(); });
+    }
+
+    int size() const{
+        return this->workers.size();
+    }
+
+    ~ThreadPool(){
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->stopping = true;
+        }
+        this->available.notify_all();
+        for(size_t i=0; i<this->workers.size(); i++){
+            this->workers[i].join();
+        }
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <fstream>
+#include <cstdint>
+
+//Tracing policies for Btree. A policy provides a Scope that times the phase
+//it is alive for and an ENABLED flag guarding work done only for tracing.
+
+//Default policy: Scope is empty and ENABLED is false, so tracing compiles
+//to nothing
+struct NoTracer{
+    static const bool ENABLED = false;
+
+    struct Scope{
+        Scope(const char* /*name*/, int /*level*/ = -1) {}
+    };
+};
+
+//Records every phase as a Chrome trace event ("ph": "X"); write() produces a
+//file chrome://tracing and Perfetto can open
+class ChromeTracer{
+private:
+    struct Event{
+        const char* name;
+        int level;
+        uint64_t start;
+        uint64_t duration;
+    };
+
+    struct Buffer{
+        int thread;
+        std::vector<Event> events;
+    };
+
+    static std::mutex& registryMutex(){
+        static std::mutex mutex;
+        return mutex;
+    }
+
+    static std::vector<Buffer*>& buffers(){
+        static std::vector<Buffer*> all;
+        return all;
+    }
+
+    static Buffer* newBuffer(){
+        Buffer* buffer = new Buffer();
+        std::lock_guard<std::mutex> guard(registryMutex());
+        buffer->thread = buffers().size();
+        buffers().push_back(buffer);
+        return buffer;
+    }
+
+    static Buffer& local(){
+        thread_local Buffer* buffer = newBuffer();
+        return *buffer;
+    }
+
+public:
+    static const bool ENABLED = true;
+
+    static uint64_t now(){
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    struct Scope{
+        const char* name;
+        int level;
+        uint64_t start;
+
+        Scope(const char* name, int level = -1){
+            this->name = name;
+            this->level = level;
+            this->start = ChromeTracer::now();
+        }
+
+        ~Scope(){
+            Event event = {this->name, this->level, this->start, ChromeTracer::now() - this->start};
+            ChromeTracer::local().events.push_back(event);
+        }
+    };
+
+    //Writes the events of all threads, must not race with tracing threads
+    static bool write(const std::string& path){
+        std::ofstream file(path);
+        if(!file.is_open())
+            return false;
+        std::lock_guard<std::mutex> guard(registryMutex());
+        std::vector<Buffer*>& all = buffers();
+        file << std::fixed;
+        file.precision(3);
+        file << "{\"traceEvents\": [" << std::endl;
+        bool first = true;
+        for(size_t b=0; b<all.size(); b++){
+            for(size_t e=0; e<all[b]->events.size(); e++){
+                const Event& event = all[b]->events[e];
+                if(!first)
+                    file << "," << std::endl;
+                first = false;
+                file << "{\"name\": \"" << event.name << "\", \"cat\": \"btree\", \"ph\": \"X\""
+                     << ", \"ts\": " << event.start / 1000.0
+                     << ", \"dur\": " << event.duration / 1000.0
+                     << ", \"pid\": 1, \"tid\": " << all[b]->thread;
+                if(event.level >= 0)
+                    file << ", \"args\": {\"level\": " << event.level << "}";
+                file << "}";
+            }
+        }
+        file << std::endl << "]}" << std::endl;
+        return file.good();
+    }
+
+    static size_t count(){
+        std::lock_guard<std::mutex> guard(registryMutex());
+        size_t events = 0;
+        for(size_t b=0; b<buffers().size(); b++){
+            events += buffers()[b]->events.size();
+        }
+        return events;
+    }
+
+    static void clear(){
+        std::lock_guard<std::mutex> guard(registryMutex());
+        for(size_t b=0; b<buffers().size(); b++){
+            buffers()[b]->events.clear();
+        }
+    }
+};
@@ -8,7 +8,7 @@
 
 #include "Page.h"
 
-template<class Key, class Value, class PageType> class Btree;
+template<class Key, class Value, class PageType, class Tracer, class Summary> class Btree;
 
 template<class Key, class Value> class TreePage : public Page<Key, Value>{
 private:
@@ -120,6 +120,28 @@ public:
         (*this->items)[key] = value;
     }
 
+    Value* findOrAdd(Key key, const Value& value, bool& inserted){
+        assert(this->isExternal());
+        std::pair<typename std::map<Key, Value>::iterator, bool> slot = this->items->insert(std::make_pair(key, value));
+        inserted = slot.second;
+        return &slot.first->second;
+    }
+
+    unsigned int addSorted(const std::pair<Key, Value>* entries, unsigned int n, unsigned int limit, unsigned int& inserted){
+        assert(this->isExternal());
+        unsigned int used = 0;
+        inserted = 0;
+        for(; used < n; used++){
+            if(this->items->find(entries[used].first) == this->items->end()){
+                if(this->items->size() >= limit)
+                    break;
+                inserted++;
+            }
+            (*this->items)[entries[used].first] = entries[used].second;
+        }
+        return used;
+    }
+
     void add(Key key, Page<Key, Value>* page) {
         assert(!this->isExternal());
         // add page to page
@@ -170,19 +192,25 @@ public:
     }
 
     TreePage* split(){
+        if( this->bottom) {
+            return this->split(this->items->size() / 2);
+        } else {
+            return this->split(this->pages->size() / 2);
+        }
+    }
+
+    TreePage* split(unsigned int at){
         TreePage* page = new TreePage(this->bottom, this->order);
         if( this->bottom) {
-            int half = this->items->size() / 2;
             typename std::map<Key, Value>::iterator it = this->items->begin();
-            std::advance(it, half);
+            std::advance(it, at);
             while (it != this->items->end()) {
                 page->add(it->first, it->second);
                 it = this->items->erase(it);
             }
         } else {
-            int half = this->pages->size() / 2;
             typename std::map<Key, TreePage*>::iterator it = this->pages->begin();
-            std::advance(it, half);
+            std::advance(it, at);
             while (it != this->pages->end()) {
                 page->add(it->first, it->second);
                 it = this->pages->erase(it);
@@ -256,6 +284,22 @@ public:
         }
     }
 
+    void removeAt(unsigned int index, unsigned int entries){
+        if (this->bottom) {
+            typename std::map<Key, Value>::iterator it = this->items->begin();
+            std::advance(it, index);
+            for(unsigned int i=0; i<entries; i++){
+                it = this->items->erase(it);
+            }
+        } else {
+            typename std::map<Key, TreePage*>::iterator it = this->pages->begin();
+            std::advance(it, index);
+            for(unsigned int i=0; i<entries; i++){
+                it = this->pages->erase(it);
+            }
+        }
+    }
+
     void replaceKey(Key oldKey, Key newKey){
         if (this->bottom) {
             Value value = this->items->operator[](oldKey);
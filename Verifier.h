@@ -0,0 +1,253 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Page.h"
+#include "PageFile.h"
+#include "Superblock.h"
+#include "ThreadPool.h"
+
+//Checks a saved tree in two passes, each spread over a thread pool. The
+//first reads every page file reachable from the superblock and checks it
+//against its checksum, a level at a time. The second, run only if the files
+//are intact, loads the pages and checks the invariants of the tree: keys
+//ascending within a page, each separator equal to the first key of its
+//child, every key of a child below the next separator, no page at or over
+//the order, all leaves at the same depth and, if the tree keeps them, the
+//stored subtree counts.
+
+static const char RECORD_SEPARATOR = 30;
+
+class Report{
+private:
+    std::mutex mutex;
+    std::vector<std::string> errors;
+
+public:
+    std::atomic<uint64_t> pages;
+    std::atomic<uint64_t> entries;
+    std::atomic<uint64_t> bytes;
+
+    Report() : pages(0), entries(0), bytes(0){
+    }
+
+    void error(const std::string& id, const std::string& message){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        this->errors.push_back("page " + id + ": " + message);
+    }
+
+    size_t failures(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        return this->errors.size();
+    }
+
+    void print(){
+        std::lock_guard<std::mutex> guard(this->mutex);
+        for(size_t i=0; i<this->errors.size() && i<100; i++){
+            std::cout << this->errors[i] << std::endl;
+        }
+        if(this->errors.size() > 100)
+            std::cout << "... and " << this->errors.size() - 100 << " more" << std::endl;
+    }
+};
+
+//Reads the files of one page, returns the ids of its children
+inline std::vector<std::string> checkFiles(const std::string& id, int depth, int height, Report& report){
+    std::vector<std::string> children;
+    std::string data;
+    if(PageFile::exists(id + ".idx")){
+        std::string meta;
+        if(!PageFile::read(id + ".idx", data) || !PageFile::read(id + ".meta.idx", meta)){
+            report.error(id, "unreadable");
+            return children;
+        }
+        report.bytes += data.size() + meta.size();
+        std::istringstream ids(meta);
+        std::string child;
+        while(std::getline(ids, child, RECORD_SEPARATOR)){
+            children.push_back(child);
+        }
+        if(depth == height - 1)
+            report.error(id, "internal page at the depth of the leaves");
+    } else {
+        if(!PageFile::read(id + ".values.idx", data)){
+            report.error(id, "unreadable");
+            return children;
+        }
+        report.bytes += data.size();
+        if(depth != height - 1)
+            report.error(id, "leaf at depth " + std::to_string(depth) + " of a tree of height " + std::to_string(height));
+    }
+    std::string filter;
+    if(PageFile::exists(id + ".filter.idx") && !PageFile::read(id + ".filter.idx", filter))
+        report.error(id, "unreadable filter");
+    report.pages++;
+    return children;
+}
+
+inline void checkAllFiles(const Superblock& super, ThreadPool& pool, Report& report){
+    std::vector<std::string> level(1, super.rootId);
+    for(int depth=0; !level.empty(); depth++){
+        std::vector<std::vector<std::string>> children(level.size());
+        for(size_t i=0; i<level.size(); i++){
+            pool.submit([&, i, depth]{
+                children[i] = checkFiles(level[i], depth, super.height, report);
+            });
+        }
+        pool.wait();
+        std::vector<std::string> next;
+        for(size_t i=0; i<children.size(); i++){
+            next.insert(next.end(), children[i].begin(), children[i].end());
+        }
+        level.swap(next);
+    }
+}
+
+template<class Key, class Value> class Verifier{
+private:
+    //a subtree checked by one task
+    struct Task{
+        Page<Key, Value>* page;
+        bool hasLow;
+        Key low;
+        bool hasHigh;
+        Key high;
+        int depth;
+        uint64_t entries;
+    };
+
+    int order;
+    int height;
+    //whether the tree kept its subtree counts, a tree that stopped keeping
+    //them leaves stale ones behind
+    bool counting;
+    Report& report;
+
+    static std::string show(const Key& key){
+        std::ostringstream out;
+        out << key;
+        return out.str();
+    }
+
+    //Checks the page alone, its keys against the separators around it
+    void checkPage(Page<Key, Value>* page, bool hasLow, const Key& low, bool hasHigh, const Key& high, int depth){
+        std::string id = page->getId();
+        unsigned int count = page->count();
+        this->report.pages++;
+        if(count == 0){
+            this->report.error(id, "empty");
+            return;
+        }
+        if(count >= (unsigned int)this->order)
+            this->report.error(id, std::to_string(count) + " entries, the order is " + std::to_string(this->order));
+        if(page->isExternal() != (depth == this->height - 1))
+            this->report.error(id, "leaf and depth disagree at depth " + std::to_string(depth));
+        if(hasLow && !(page->firstKey() == low))
+            this->report.error(id, "first key " + show(page->firstKey()) + " is not the separator " + show(low));
+        for(unsigned int i=1; i<count; i++){
+            if(!(page->getKeyAt(i - 1) < page->getKeyAt(i)))
+                this->report.error(id, "key " + show(page->getKeyAt(i)) + " at " + std::to_string(i) + " is out of order");
+        }
+        if(hasHigh && !(page->lastKey() < high))
+            this->report.error(id, "last key " + show(page->lastKey()) + " is not below the next separator " + show(high));
+    }
+
+    //Checks the children of page given the entries under each, returns the
+    //entries under page
+    uint64_t checkCounts(Page<Key, Value>* page, const std::vector<uint64_t>& entries){
+        uint64_t total = 0;
+        for(unsigned int i=0; i<entries.size(); i++){
+            uint64_t count = page->getCountAt(i);
+            if(this->counting && count != Page<Key, Value>::UNCOUNTED && count != entries[i])
+                this->report.error(page->getId(), "child " + std::to_string(i) + " is counted " + std::to_string(count) + " but holds " + std::to_string(entries[i]));
+            total += entries[i];
+        }
+        return total;
+    }
+
+    //Checks a subtree and closes its pages again, returns its leaf entries
+    uint64_t checkSubtree(Page<Key, Value>* page, bool hasLow, const Key& low, bool hasHigh, const Key& high, int depth){
+        this->checkPage(page, hasLow, low, hasHigh, high, depth);
+        uint64_t total = 0;
+        if(page->isExternal()){
+            total = page->count();
+            this->report.entries += total;
+        } else if(depth < this->height - 1){
+            std::vector<uint64_t> entries;
+            for(unsigned int i=0; i<page->count(); i++){
+                bool childHasHigh = i + 1 < page->count() || hasHigh;
+                Key childHigh = i + 1 < page->count() ? page->getKeyAt(i + 1) : high;
+                entries.push_back(this->checkSubtree(page->getPageAt(i), true, page->getKeyAt(i), childHasHigh, childHigh, depth + 1));
+            }
+            total = this->checkCounts(page, entries);
+        }
+        page->close();
+        return total;
+    }
+
+    //Checks the pages above the tasks and adds the tasks below them
+    void split(Page<Key, Value>* page, bool hasLow, const Key& low, bool hasHigh, const Key& high, int depth, int taskDepth, std::vector<Task>& tasks){
+        this->checkPage(page, hasLow, low, hasHigh, high, depth);
+        if(page->isExternal() || depth >= this->height - 1)
+            return;
+        for(unsigned int i=0; i<page->count(); i++){
+            bool childHasHigh = i + 1 < page->count() || hasHigh;
+            Key childHigh = i + 1 < page->count() ? page->getKeyAt(i + 1) : high;
+            if(depth + 1 == taskDepth){
+                Task task = {page->getPageAt(i), true, page->getKeyAt(i), childHasHigh, childHigh, depth + 1, 0};
+                tasks.push_back(task);
+            } else {
+                this->split(page->getPageAt(i), true, page->getKeyAt(i), childHasHigh, childHigh, depth + 1, taskDepth, tasks);
+            }
+        }
+    }
+
+    //Counts the pages above the tasks once the tasks are done
+    uint64_t total(Page<Key, Value>* page, int depth, int taskDepth, std::vector<Task>& tasks, size_t& next){
+        if(page->isExternal() || depth >= this->height - 1)
+            return page->isExternal() ? page->count() : 0;
+        std::vector<uint64_t> entries;
+        for(unsigned int i=0; i<page->count(); i++){
+            if(depth + 1 == taskDepth)
+                entries.push_back(tasks[next++].entries);
+            else
+                entries.push_back(this->total(page->getPageAt(i), depth + 1, taskDepth, tasks, next));
+        }
+        return this->checkCounts(page, entries);
+    }
+
+public:
+    Verifier(int order, int height, bool counting, Report& report) : order(order), height(height), counting(counting), report(report){
+    }
+
+    template<class PageType> void run(const std::string& rootId, ThreadPool& pool){
+        PageType* root = new PageType(rootId, this->order);
+        root->open();
+        //tasks start at the first level with a few per thread
+        int taskDepth = 1;
+        unsigned int width = root->isExternal() ? 1 : root->count();
+        while(taskDepth < this->height - 1 && width < 4 * (unsigned int)pool.size()){
+            width *= this->order / 2;
+            taskDepth++;
+        }
+        std::vector<Task> tasks;
+        Key none = Key();
+        this->split(root, false, none, false, none, 0, taskDepth, tasks);
+        if(root->isExternal())
+            this->report.entries += root->count();
+        for(size_t i=0; i<tasks.size(); i++){
+            pool.submit([this, &tasks, i]{
+                Task& task = tasks[i];
+                task.entries = this->checkSubtree(task.page, task.hasLow, task.low, task.hasHigh, task.high, task.depth);
+            });
+        }
+        pool.wait();
+        size_t next = 0;
+        this->total(root, 0, taskDepth, tasks, next);
+        delete root;
+    }
+};
@@ -0,0 +1,214 @@
+#include <sys/stat.h>
+#include <dirent.h>
+#include <cstdio>
+#include <iomanip>
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+
+//Reports the shape of a saved tree: pages, fill factors, key and value sizes
+//and bytes on disk per level, plus how much of the tree is slack. The tree
+//is walked one path at a time so it never has to fit in memory.
+
+static const char* PAGE_FILES[] = {".idx", ".meta.idx", ".values.idx", ".filter.idx"};
+
+static uint64_t fileSize(const std::string& path){
+    struct stat st;
+    if(stat(path.c_str(), &st) != 0)
+        return 0;
+    return st.st_size;
+}
+
+template<class T> static uint64_t sizeOf(const T& /*value*/){
+    return sizeof(T);
+}
+
+static uint64_t sizeOf(const std::string& value){
+    return value.size();
+}
+
+//Power of two buckets: bucket b counts values in [2^(b-1), 2^b)
+class SizeHistogram{
+private:
+    std::vector<uint64_t> buckets;
+
+public:
+    SizeHistogram() : buckets(65, 0){
+    }
+
+    void record(uint64_t value){
+        int bucket = 0;
+        while(bucket < 64 && (value >> bucket) != 0){
+            bucket++;
+        }
+        this->buckets[bucket]++;
+    }
+
+    void print(const std::string& indent) const{
+        for(int b=0; b<65; b++){
+            if(this->buckets[b] == 0)
+                continue;
+            uint64_t low = b == 0 ? 0 : (uint64_t)1 << (b - 1);
+            uint64_t high = b == 0 ? 0 : ((uint64_t)1 << b) - 1;
+            std::cout << indent << std::setw(8) << low << " - " << std::setw(8) << high << ": " << this->buckets[b] << std::endl;
+        }
+    }
+};
+
+struct Level{
+    uint64_t pages;
+    uint64_t keys;
+    uint64_t bytes;
+    uint64_t underfull;
+    //fill factor in tenths, the last bucket is full pages
+    std::vector<uint64_t> fill;
+
+    Level() : pages(0), keys(0), bytes(0), underfull(0), fill(11, 0){
+    }
+};
+
+template<class Key, class Value, class PageType> static int analyze(const std::string& name, bool orphans){
+    Btree<Key, Value, PageType> btree(name);
+    unsigned int order = btree.get_order();
+    //a page splits once it reaches the order, so order - 1 entries is full
+    unsigned int capacity = order > 1 ? order - 1 : 1;
+    std::vector<Level> levels(btree.get_height());
+    SizeHistogram keySizes;
+    SizeHistogram valueSizes;
+    uint64_t keyBytes = 0;
+    uint64_t valueBytes = 0;
+    uint64_t values = 0;
+    std::set<std::string> reachable;
+
+    btree.walk([&](Page<Key, Value>* page, int depth){
+        if(depth >= (int)levels.size())
+            levels.resize(depth + 1);
+        Level& level = levels[depth];
+        unsigned int count = page->count();
+        level.pages++;
+        level.keys += count;
+        unsigned int tenths = count * 10 / capacity;
+        level.fill[tenths > 10 ? 10 : tenths]++;
+        if(count < order / 2)
+            level.underfull++;
+        for(int f=0; f<4; f++){
+            level.bytes += fileSize(page->getId() + PAGE_FILES[f]);
+        }
+        if(orphans)
+            reachable.insert(page->getId());
+        for(unsigned int i=0; i<count; i++){
+            uint64_t size = sizeOf(page->getKeyAt(i));
+            keySizes.record(size);
+            keyBytes += size;
+            if(page->isExternal()){
+                size = sizeOf(*page->getValueAt(i));
+                valueSizes.record(size);
+                valueBytes += size;
+                values++;
+            }
+        }
+    }, true);
+
+    uint64_t pages = 0;
+    uint64_t slots = 0;
+    uint64_t used = 0;
+    uint64_t bytes = 0;
+    std::cout << "tree " << name << ": order " << order << ", height " << btree.get_height() << ", " << btree.count() << " keys" << std::endl;
+    for(size_t l=0; l<levels.size(); l++){
+        const Level& level = levels[l];
+        pages += level.pages;
+        slots += level.pages * capacity;
+        used += level.keys;
+        bytes += level.bytes;
+        std::cout << "level " << l << (l + 1 == levels.size() ? " (leaves)" : "") << ": "
+                  << level.pages << " pages, " << level.keys << " entries, "
+                  << std::fixed << std::setprecision(1)
+                  << (level.pages ? 100.0 * level.keys / (level.pages * capacity) : 0) << "% average fill, "
+                  << level.underfull << " under half full, " << level.bytes << " bytes on disk" << std::endl;
+        std::cout << "  fill factor:";
+        for(int f=0; f<=10; f++){
+            if(level.fill[f] > 0)
+                std::cout << " " << f * 10 << (f < 10 ? "%+" : "%") << "=" << level.fill[f];
+        }
+        std::cout << std::endl;
+    }
+
+    std::cout << "key sizes (bytes), average " << (used ? (double)keyBytes / used : 0) << ":" << std::endl;
+    keySizes.print("  ");
+    std::cout << "value sizes (bytes), average " << (values ? (double)valueBytes / values : 0) << ":" << std::endl;
+    valueSizes.print("  ");
+
+    std::cout << "total: " << pages << " pages, " << bytes << " bytes on disk, "
+              << (slots ? 100.0 * (slots - used) / slots : 0) << "% of page slots unused" << std::endl;
+
+    if(orphans){
+        //page files in the directory that the tree no longer references
+        uint64_t orphanFiles = 0;
+        uint64_t orphanBytes = 0;
+        DIR* dir = opendir(".");
+        struct dirent* entry;
+        while(dir != NULL && (entry = readdir(dir)) != NULL){
+            std::string file = entry->d_name;
+            //the longer suffixes come first so ".idx" only matches the main file
+            for(int f=3; f>=0; f--){
+                std::string suffix = PAGE_FILES[f];
+                if(file.size() <= suffix.size() || file.compare(file.size() - suffix.size(), suffix.size(), suffix) != 0)
+                    continue;
+                std::string id = file.substr(0, file.size() - suffix.size());
+                bool tree = id == name || id == name + ".super.0" || id == name + ".super.1" || id == name + ".hot";
+                if(!tree && reachable.count(id) == 0){
+                    orphanFiles++;
+                    orphanBytes += fileSize(file);
+                }
+                break;
+            }
+        }
+        if(dir != NULL)
+            closedir(dir);
+        std::cout << "orphaned: " << orphanFiles << " page files, " << orphanBytes << " bytes" << std::endl;
+    }
+    return 0;
+}
+
+static void usage(){
+    std::cout << "usage: analyze <tree name> [-p flat|compound] [--orphans]" << std::endl
+              << "  flat reads FlatPage<int, int> trees, compound CompoundObjectsFlatPage<string, string>" << std::endl
+              << "  --orphans also counts page files in the directory the tree does not reference,\n"
+              << "            which assumes the directory holds only this tree" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    std::string name;
+    bool compound = false;
+    bool orphans = false;
+    for(int i=1; i<argc; i++){
+        std::string arg = argv[i];
+        if(arg == "-p" && i + 1 < argc){
+            compound = std::string(argv[++i]) == "compound";
+        } else if(arg == "--orphans"){
+            orphans = true;
+        } else if(name.empty() && arg[0] != '-'){
+            name = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if(name.empty()){
+        usage();
+        return 1;
+    }
+    Superblock super;
+    if(!Superblock::load(name, super)){
+        std::cout << "Error: no tree named " << name << std::endl;
+        return 1;
+    }
+
+    if(compound)
+        return analyze<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>>(name, orphans);
+    return analyze<int, int, FlatPage<int, int>>(name, orphans);
+}
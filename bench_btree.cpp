@@ -0,0 +1,275 @@
+#include <benchmark/benchmark.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <map>
+#include <memory>
+
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+#include "KeyGenerator.h"
+
+//Key types under test: each maps a key index to a key and a value
+struct IntKeys{
+    typedef int Key;
+    typedef int Value;
+    typedef FlatPage<int, int> PageType;
+    static Key key(uint64_t i){ return (int)i; }
+    static Value value(uint64_t i){ return (int)i; }
+    static Key sentinel(){ return -1; }
+};
+
+struct ShortStringKeys{
+    typedef std::string Key;
+    typedef std::string Value;
+    typedef CompoundObjectsFlatPage<std::string, std::string> PageType;
+    static Key key(uint64_t i){ return "k" + std::to_string(i); }
+    static Value value(uint64_t i){ return "v" + std::to_string(i); }
+    static Key sentinel(){ return ""; }
+};
+
+struct LongStringKeys{
+    typedef std::string Key;
+    typedef std::string Value;
+    typedef CompoundObjectsFlatPage<std::string, std::string> PageType;
+    static Key key(uint64_t i){ return "tenant/0042/customer/profile/" + std::to_string(i) + "/settings"; }
+    static Value value(uint64_t i){ return std::string(64, 'v') + std::to_string(i); }
+    static Key sentinel(){ return ""; }
+};
+
+//Key index distributions
+struct Sequential{
+    static KeyGenerator* make(uint64_t n){ return new SequentialGenerator(n); }
+};
+
+struct Uniform{
+    static KeyGenerator* make(uint64_t n){ return new UniformGenerator(n); }
+};
+
+struct Zipfian{
+    static KeyGenerator* make(uint64_t n){ return new ZipfianGenerator(n); }
+};
+
+//Removes the page files written by the previous iteration
+static void removePageFiles(){
+    DIR* dir = opendir(".");
+    if(dir == NULL)
+        return;
+    struct dirent* entry;
+    while((entry = readdir(dir)) != NULL){
+        std::string name = entry->d_name;
+        if(name.size() > 4 && name.compare(name.size() - 4, 4, ".idx") == 0)
+            unlink(name.c_str());
+    }
+    closedir(dir);
+}
+
+template<class Keys> static Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType>* build(int order, int n){
+    Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType>* btree = new Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType>(order, Keys::sentinel(), Keys::value(0), true);
+    UniformGenerator shuffle(n);
+    std::vector<uint64_t> indexes(n);
+    for(int i=0; i<n; i++){
+        indexes[i] = i;
+    }
+    for(int i=n-1; i>0; i--){
+        std::swap(indexes[i], indexes[shuffle.next() % (i + 1)]);
+    }
+    for(int i=0; i<n; i++){
+        btree->put(Keys::key(indexes[i]), Keys::value(indexes[i]));
+    }
+    return btree;
+}
+
+//Read-only benchmarks share one tree per key type, order and size
+template<class Keys> static Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType>* shared(int order, int n){
+    typedef Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType> Tree;
+    static std::map<std::pair<int, int>, Tree*> trees;
+    std::pair<int, int> at(order, n);
+    if(trees.count(at) == 0)
+        trees[at] = build<Keys>(order, n);
+    return trees[at];
+}
+
+template<class Keys, class Dist> static std::vector<typename Keys::Key> keys(int n, int count){
+    std::unique_ptr<KeyGenerator> gen(Dist::make(n));
+    std::vector<typename Keys::Key> result(count);
+    for(int i=0; i<count; i++){
+        result[i] = Keys::key(gen->next());
+    }
+    return result;
+}
+
+//args: page order, tree size
+template<class Keys, class Dist> static void BM_Put(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    std::vector<typename Keys::Key> input = keys<Keys, Dist>(n, n);
+    for(auto _ : state){
+        Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType> btree(order, Keys::sentinel(), Keys::value(0), true);
+        for(int i=0; i<n; i++){
+            btree.put(input[i], Keys::value(i));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+//args: page order, tree size, batch size
+template<class Keys, class Dist> static void BM_PutBatch(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    int batchSize = state.range(2);
+    std::vector<typename Keys::Key> input = keys<Keys, Dist>(n, n);
+    for(auto _ : state){
+        Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType> btree(order, Keys::sentinel(), Keys::value(0), true);
+        std::vector<std::pair<typename Keys::Key, typename Keys::Value>> batch;
+        for(int i=0; i<n; i++){
+            batch.push_back(std::make_pair(input[i], Keys::value(i)));
+            if((int)batch.size() == batchSize || i == n - 1){
+                btree.putBatch(batch);
+                batch.clear();
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+template<class Keys, class Dist> static void BM_Get(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    auto btree = shared<Keys>(order, n);
+    //twice the key range, so about half of the lookups miss
+    std::vector<typename Keys::Key> input = keys<Keys, Dist>(2 * n, 4096);
+    for(auto _ : state){
+        for(size_t i=0; i<input.size(); i++){
+            benchmark::DoNotOptimize(btree->get(input[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+template<class Keys> static void BM_DeleteKey(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    std::vector<typename Keys::Key> input = keys<Keys, Sequential>(n, n);
+    for(auto _ : state){
+        state.PauseTiming();
+        auto btree = build<Keys>(order, n);
+        state.ResumeTiming();
+        for(int i=0; i<n; i++){
+            btree->deleteKey(input[i]);
+        }
+        state.PauseTiming();
+        delete btree;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+//args: page order, tree size, keys per scan
+template<class Keys> static void BM_RangeScan(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    int length = state.range(2);
+    auto btree = shared<Keys>(order, n);
+    UniformGenerator gen(n - length);
+    int64_t scanned = 0;
+    for(auto _ : state){
+        uint64_t from = gen.next();
+        typename Keys::Key a = Keys::key(from);
+        typename Keys::Key b = Keys::key(from + length);
+        if(b < a)
+            std::swap(a, b);
+        auto it = btree->get(a, b);
+        while(!it.isEnd()){
+            benchmark::DoNotOptimize(*it);
+            it++;
+            scanned++;
+        }
+    }
+    state.SetItemsProcessed(scanned);
+}
+
+template<class Keys> static void BM_Save(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    for(auto _ : state){
+        state.PauseTiming();
+        removePageFiles();
+        auto btree = build<Keys>(order, n);
+        state.ResumeTiming();
+        btree->save("bench_save");
+        state.PauseTiming();
+        delete btree;
+        state.ResumeTiming();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+}
+
+//Opens a saved tree and runs cold lookups against it
+template<class Keys> static void BM_Open(benchmark::State& state){
+    int order = state.range(0);
+    int n = state.range(1);
+    removePageFiles();
+    auto saved = build<Keys>(order, n);
+    saved->save("bench_open");
+    delete saved;
+    std::vector<typename Keys::Key> input = keys<Keys, Uniform>(n, 256);
+    for(auto _ : state){
+        Btree<typename Keys::Key, typename Keys::Value, typename Keys::PageType> btree("bench_open");
+        for(size_t i=0; i<input.size(); i++){
+            benchmark::DoNotOptimize(btree.get(input[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * input.size());
+}
+
+static void Shapes(benchmark::internal::Benchmark* b){
+    for(int order : {16, 64}){
+        for(int n : {1 << 12, 1 << 16}){
+            b->Args({order, n});
+        }
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Put, IntKeys, Sequential)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, IntKeys, Uniform)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, IntKeys, Zipfian)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, ShortStringKeys, Sequential)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, ShortStringKeys, Uniform)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, ShortStringKeys, Zipfian)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Put, LongStringKeys, Uniform)->Apply(Shapes);
+
+BENCHMARK_TEMPLATE(BM_PutBatch, IntKeys, Sequential)->Args({64, 1 << 16, 1 << 10})->Args({64, 1 << 16, 1 << 14});
+BENCHMARK_TEMPLATE(BM_PutBatch, IntKeys, Uniform)->Args({64, 1 << 16, 1 << 10})->Args({64, 1 << 16, 1 << 14});
+BENCHMARK_TEMPLATE(BM_PutBatch, ShortStringKeys, Uniform)->Args({64, 1 << 16, 1 << 10})->Args({64, 1 << 16, 1 << 14});
+
+BENCHMARK_TEMPLATE(BM_Get, IntKeys, Sequential)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Get, IntKeys, Uniform)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Get, IntKeys, Zipfian)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Get, ShortStringKeys, Uniform)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Get, ShortStringKeys, Zipfian)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_Get, LongStringKeys, Uniform)->Apply(Shapes);
+
+BENCHMARK_TEMPLATE(BM_DeleteKey, IntKeys)->Apply(Shapes);
+BENCHMARK_TEMPLATE(BM_DeleteKey, ShortStringKeys)->Apply(Shapes);
+
+BENCHMARK_TEMPLATE(BM_RangeScan, IntKeys)->Args({64, 1 << 16, 100})->Args({64, 1 << 16, 10000});
+BENCHMARK_TEMPLATE(BM_RangeScan, ShortStringKeys)->Args({64, 1 << 16, 100});
+
+BENCHMARK_TEMPLATE(BM_Save, IntKeys)->Args({64, 1 << 16})->Iterations(5);
+BENCHMARK_TEMPLATE(BM_Save, ShortStringKeys)->Args({64, 1 << 16})->Iterations(5);
+BENCHMARK_TEMPLATE(BM_Open, IntKeys)->Args({64, 1 << 16});
+BENCHMARK_TEMPLATE(BM_Open, ShortStringKeys)->Args({64, 1 << 16});
+
+//Page files are written to the working directory, keep them in their own
+int main(int argc, char** argv){
+    mkdir("bench_data", 0755);
+    if(chdir("bench_data") != 0)
+        return 1;
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    removePageFiles();
+    return 0;
+}
@@ -0,0 +1,67 @@
+#!/usr/bin/env python3
+"""Compares two Google Benchmark JSON reports and flags regressions.
+
+usage: bench_compare.py BASELINE.json CURRENT.json [--threshold PERCENT]
+
+Exits with status 1 when any benchmark got slower than the threshold.
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as f:
+        report = json.load(f)
+    results = {}
+    for bench in report.get("benchmarks", []):
+        if bench.get("run_type") == "aggregate":
+            continue
+        results[bench["name"]] = bench
+    return results
+
+
+def throughput(bench):
+    # items per second is comparable across iteration counts, fall back to
+    # the inverse of the cpu time for benchmarks that do not report items
+    if "items_per_second" in bench:
+        return bench["items_per_second"]
+    return 1.0 / bench["cpu_time"]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0,
+                        help="slowdown in percent that counts as a regression")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = 0
+    width = max([len(name) for name in current] + [9])
+    print("%-*s %12s" % (width, "benchmark", "change"))
+    for name in current:
+        if name not in baseline:
+            print("%-*s %12s" % (width, name, "new"))
+            continue
+        change = (throughput(current[name]) / throughput(baseline[name]) - 1) * 100
+        flag = ""
+        if change < -args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        print("%-*s %+11.1f%%%s" % (width, name, change, flag))
+    for name in baseline:
+        if name not in current:
+            print("%-*s %12s" % (width, name, "missing"))
+
+    if regressions:
+        print("%d benchmark(s) regressed by more than %.1f%%" % (regressions, args.threshold))
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,56 @@
+#include <benchmark/benchmark.h>
+#include <random>
+#include <algorithm>
+#include "btree.h"
+
+//Trees of a few million keys, several times larger than the last level cache
+static Btree<int, int, FlatPage<int, int>>* tree(int n){
+    static std::map<int, Btree<int, int, FlatPage<int, int>>*> trees;
+    if(trees.count(n) == 0){
+        Btree<int, int, FlatPage<int, int>>* btree = new Btree<int, int, FlatPage<int, int>>(64, -1, -1, true);
+        std::mt19937 gen(42);
+        std::vector<int> keys(n);
+        for(int i=0; i<n; i++){
+            keys[i] = i * 2;
+        }
+        std::shuffle(keys.begin(), keys.end(), gen);
+        for(int i=0; i<n; i++){
+            btree->put(keys[i], i);
+        }
+        trees[n] = btree;
+    }
+    return trees[n];
+}
+
+static std::vector<int> lookups(int n, int batch){
+    std::mt19937 gen(7);
+    std::uniform_int_distribution<int> dis(0, 2 * n);
+    std::vector<int> keys(batch);
+    for(int i=0; i<batch; i++){
+        keys[i] = dis(gen);
+    }
+    return keys;
+}
+
+static void BM_SequentialGet(benchmark::State& state){
+    Btree<int, int, FlatPage<int, int>>* btree = tree(state.range(0));
+    std::vector<int> keys = lookups(state.range(0), 4096);
+    for(auto _ : state){
+        for(size_t i=0; i<keys.size(); i++){
+            benchmark::DoNotOptimize(btree->get(keys[i]));
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+static void BM_InterleavedGet(benchmark::State& state){
+    Btree<int, int, FlatPage<int, int>>* btree = tree(state.range(0));
+    std::vector<int> keys = lookups(state.range(0), 4096);
+    for(auto _ : state){
+        benchmark::DoNotOptimize(btree->getInterleaved(keys, state.range(1)));
+    }
+    state.SetItemsProcessed(state.iterations() * keys.size());
+}
+
+BENCHMARK(BM_SequentialGet)->Arg(1 << 16)->Arg(1 << 22);
+BENCHMARK(BM_InterleavedGet)->Args({1 << 16, 8})->Args({1 << 22, 4})->Args({1 << 22, 8})->Args({1 << 22, 16});
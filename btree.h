@@ -1,4 +1,10 @@
 #include <map>
+#include <set>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <utility>
+#include <algorithm>
 #include <fstream>
 #include <cstring>
 #include <cassert>
@@ -8,16 +14,385 @@
 #include "TreePage.h"
 #include "FlatPage.h"
 #include "Iterator.h"
+#include "Stats.h"
+#include "Tracer.h"
+#include "SplitPolicy.h"
+#include "Summary.h"
+#include "Superblock.h"
+#include "ThreadPool.h"
+#include "Prefetcher.h"
 
 
 
-template<class Key, class Value, class PageType> class Btree{
+//Tracer times the phases of get/put/deleteKey, the default NoTracer compiles
+//all of it away. Summary picks what internal pages summarize the values
+//under each child with, for aggregate; the default keeps no summaries.
+template<class Key, class Value, class PageType, class Tracer = NoTracer, class Summary = NoSummary<Value>> class Btree{
 private:
     Page<Key, Value>* root;
     int order;  // max children per B-tree node = order-1
     int height; // height of the B-tree
     int n;      // number of key-value pairs in the B-tree
     bool memoryOnly;
+    //ids of pages dropped by merges, their files are deleted by the next save
+    std::vector<std::string> freed;
+    //progress of an incremental compaction: the height above the leaves of
+    //the pages whose children are coalesced, 0 when none is running, and the
+    //first key of the next page to visit
+    int compactLevel;
+    Key compactFrom;
+    SplitPolicy splitPolicy;
+    //number of puts in a row with ascending keys, ending with lastPut
+    unsigned int ascending;
+    Key lastPut;
+    //the rightmost leaf while the last put went there, NULL otherwise
+    Page<Key, Value>* appendLeaf;
+    //whether internal pages keep the number of entries under each child
+    bool counting;
+    //whether the summaries internal pages keep are up to date
+    bool summarized;
+    //keys whose values getOrInsert handed out since the summaries on their
+    //paths were last brought up to date
+    std::set<Key> handedOut;
+    //the smallest key, which is not part of any summary
+    Key sentinel;
+    //live snapshots of the tree this one started from, shared by all of them
+    std::shared_ptr<std::atomic<unsigned int>> snapshots;
+    bool isSnapshot;
+    //most pages listed in the hot list a save leaves for the next open
+    unsigned int hotPages;
+    //pages of the hot list this tree asked the prefetcher for
+    std::vector<std::string> hotPrefetched;
+
+    //ascending puts needed before ADAPTIVE treats the keys as sequential
+    static const unsigned int SEQUENTIAL_RUN = 8;
+    static const unsigned int HOT_PAGES = 4096;
+
+    //Remembers whether the key continues an ascending run of puts
+    void observe(Key key){
+        if(this->lastPut < key)
+            this->ascending++;
+        else
+            this->ascending = 0;
+        this->lastPut = key;
+    }
+
+    //sequential tells ADAPTIVE that the keys come in ascending order. A
+    //page holding more than order entries, as putBatch leaves them, gives up
+    //at most order entries to the left page. Only leaves are split off
+    //center: an internal page left with a single child could not be merged
+    //by deleteKey.
+    unsigned int splitPoint(Page<Key, Value>* page, Key key, bool sequential){
+        unsigned int size = page->count();
+        unsigned int capped = size < (unsigned int)this->order ? size : this->order;
+        unsigned int at = size / 2 + (size % 2);
+        bool atEnd = page->isExternal() && !(key < page->lastKey());
+        if(atEnd){
+            if(this->splitPolicy == SPLIT_APPEND_90)
+                at = capped * 9 / 10;
+            else if(this->splitPolicy == SPLIT_APPEND_100)
+                at = capped - 1;
+            else if(this->splitPolicy == SPLIT_ADAPTIVE && sequential)
+                at = capped - 1;
+        }
+        if(at < 1)
+            at = 1;
+        if(at > size - 1)
+            at = size - 1;
+        return at;
+    }
+
+    //Splits a full child of page until none of the pieces is full
+    void splitFull(Page<Key, Value>* page, Page<Key, Value>* child, Key key, bool sequential, int level){
+        while(child->isFull()){
+            typename Tracer::Scope split("split", level);
+            Page<Key, Value>* split_page = child->split(this->splitPoint(child, key, sequential));
+            page->add(split_page->firstKey(), split_page);
+            this->refresh(page, child);
+            this->refresh(page, split_page);
+            child = split_page;
+        }
+    }
+
+    //Leaf entries under page, from the counts of its children
+    uint64_t weigh(Page<Key, Value>* page){
+        if(page->isExternal())
+            return page->count();
+        uint64_t total = 0;
+        for(unsigned int i=0; i<page->count(); i++){
+            total += page->getCountAt(i);
+        }
+        return total;
+    }
+
+    //Sets the count and the summary page keeps for child from the child
+    void refresh(Page<Key, Value>* page, Page<Key, Value>* child){
+        if(!this->counting && !this->summarizing())
+            return;
+        int index = page->getIndexOf(child->firstKey());
+        if(index < 0)
+            index = 0;
+        if(this->counting)
+            page->setCountAt(index, this->weigh(child));
+        if(this->summarizing())
+            page->setSummaryAt(index, this->summarize(child));
+    }
+
+    bool summarizing(){
+        return Summary::ENABLED && this->summarized;
+    }
+
+    //Summary of the values under page, from the summaries of its children
+    Value summarize(Page<Key, Value>* page){
+        Value summary = Summary::identity();
+        if(page->isExternal()){
+            unsigned int i = page->count() > 0 && page->getKeyAt(0) == this->sentinel ? 1 : 0;
+            for(; i<page->count(); i++){
+                summary = Summary::combine(summary, *page->getValueAt(i));
+            }
+        } else {
+            for(unsigned int i=0; i<page->count(); i++){
+                summary = Summary::combine(summary, *page->getSummaryAt(i));
+            }
+        }
+        return summary;
+    }
+
+    //Sets the summary page keeps for child, the count is left alone
+    void resummarize(Page<Key, Value>* page, Page<Key, Value>* child){
+        if(!this->summarizing())
+            return;
+        int index = page->getIndexOf(child->firstKey());
+        if(index < 0)
+            index = 0;
+        page->setSummaryAt(index, this->summarize(child));
+    }
+
+    //Updates the summaries on the path to key after its value was changed
+    //in place
+    void resummarize(Key key){
+        if(!this->summarizing())
+            return;
+        std::vector<Page<Key, Value>*> path;
+        Page<Key, Value>* page = this->root;
+        while(!page->isExternal()){
+            path.push_back(page);
+            page = page->next(key);
+        }
+        for(int i=(int)path.size()-1; i>=0; i--){
+            this->resummarize(path[i], page);
+            page = path[i];
+        }
+    }
+
+    //Brings the summaries on the paths to the handed out keys up to date
+    void catchUpSummaries(){
+        for(typename std::set<Key>::iterator it = this->handedOut.begin(); it != this->handedOut.end(); it++){
+            this->resummarize(*it);
+        }
+        this->handedOut.clear();
+    }
+
+    //Summarizes every subtree and stores the summary of every child
+    Value summarizeSubtree(Page<Key, Value>* page){
+        if(page->isExternal())
+            return this->summarize(page);
+        Value summary = Summary::identity();
+        for(unsigned int i=0; i<page->count(); i++){
+            Value child = this->summarizeSubtree(page->getPageAt(i));
+            page->setSummaryAt(i, child);
+            summary = Summary::combine(summary, child);
+        }
+        return summary;
+    }
+
+    //Adds delta to the count of the child of page that key goes to
+    void addCount(Page<Key, Value>* page, Key key, int delta){
+        if(!this->counting)
+            return;
+        int index = page->getIndexOf(key);
+        if(index < 0)
+            index = 0;
+        page->setCountAt(index, page->getCountAt(index) + delta);
+    }
+
+    //Counts the leaf entries under page and stores the count of every child
+    uint64_t countSubtree(Page<Key, Value>* page){
+        if(page->isExternal())
+            return page->count();
+        uint64_t total = 0;
+        for(unsigned int i=0; i<page->count(); i++){
+            uint64_t count = this->countSubtree(page->getPageAt(i));
+            page->setCountAt(i, count);
+            total += count;
+        }
+        return total;
+    }
+
+    void splitRoot(Key key, bool sequential){
+        if(!this->root->isFull())
+            return;
+        Page<Key, Value>* left = this->root;
+        this->root = new PageType(this->order, false);
+        this->root->add(left->firstKey(), left);
+        this->splitFull(this->root, left, key, sequential, 0);
+        this->height++;
+        Stats::add(Stats::ROOT_SPLITS);
+    }
+
+    void init(){
+        this->compactLevel = 0;
+        this->splitPolicy = SPLIT_MIDDLE;
+        this->ascending = 0;
+        this->lastPut = Key();
+        this->appendLeaf = NULL;
+        this->counting = false;
+        this->summarized = Summary::ENABLED;
+        this->snapshots = std::make_shared<std::atomic<unsigned int>>(0);
+        this->isSnapshot = false;
+        this->hotPages = HOT_PAGES;
+    }
+
+    //Snapshot of origin, see snapshot()
+    Btree(Btree* origin){
+        this->memoryOnly = true;
+        this->order = origin->order;
+        this->height = origin->height;
+        this->n = origin->n;
+        this->root = origin->root;
+        this->root->retain();
+        this->init();
+        this->sentinel = origin->sentinel;
+        this->counting = origin->counting;
+        this->summarized = origin->summarized;
+        this->splitPolicy = origin->splitPolicy;
+        this->snapshots = origin->snapshots;
+        this->isSnapshot = true;
+        (*this->snapshots)++;
+    }
+
+    //Pages reachable from a snapshot are never modified: a writer clones
+    //every shared page on its way down before it changes anything below
+    //it. A page is only this tree's own if its whole path is, so the
+    //ownership is taken from the root down.
+
+    void ownRoot(){
+        if(!this->root->isShared())
+            return;
+        Page<Key, Value>* copy = this->root->clone();
+        this->discard(this->root);
+        this->root = copy;
+    }
+
+    //The child of page at index, cloned first if it is shared. page must be
+    //owned already
+    Page<Key, Value>* own(Page<Key, Value>* page, int index){
+        Page<Key, Value>* child = page->getPageAt(index);
+        if(!child->isShared())
+            return child;
+        Page<Key, Value>* copy = child->clone();
+        page->setPageAt(index, copy);
+        this->discard(child);
+        return copy;
+    }
+
+    Page<Key, Value>* ownNext(Page<Key, Value>* page, Key key){
+        int index = page->getIndexOf(key);
+        if(index < 0)
+            index = 0;
+        return this->own(page, index);
+    }
+
+    //Owned leaf key goes to
+    Page<Key, Value>* ownPath(Key key){
+        this->ownRoot();
+        Page<Key, Value>* page = this->root;
+        while(!page->isExternal()){
+            page = this->ownNext(page, key);
+        }
+        return page;
+    }
+
+    //Remembers the ids of a subtree this tree lets go of, returns the
+    //number of entries its leaves hold
+    unsigned int forget(Page<Key, Value>* page){
+        unsigned int entries = 0;
+        if(page->isExternal()){
+            entries = page->count();
+        } else {
+            for(unsigned int i=0; i<page->count(); i++){
+                entries += this->forget(page->getPageAt(i));
+            }
+        }
+        if(!this->memoryOnly)
+            this->freed.push_back(page->getId());
+        return entries;
+    }
+
+    //Position of diff in a tree: the pages down to the entry or subtree in
+    //front, each with the index of its next entry or child
+    struct Cursor{
+        std::vector<std::pair<Page<Key, Value>*, unsigned int>> path;
+        int height;
+
+        Cursor(Page<Key, Value>* root, int height) : height(height){
+            this->path.push_back(std::make_pair(root, 0u));
+        }
+
+        bool atEnd() const{
+            return this->path.empty();
+        }
+
+        bool atEntry(){
+            return this->path.back().first->isExternal();
+        }
+
+        //the key of the entry in front, or the first key of the subtree
+        Key key(){
+            return this->path.back().first->getKeyAt(this->path.back().second);
+        }
+
+        Value* value(){
+            return this->path.back().first->getValueAt(this->path.back().second);
+        }
+
+        Page<Key, Value>* subtree(){
+            return this->path.back().first->getPageAt(this->path.back().second);
+        }
+
+        //levels of pages under the subtree in front
+        int below() const{
+            return this->height - 1 - (int)this->path.size();
+        }
+
+        void descend(){
+            this->path.push_back(std::make_pair(this->subtree(), 0u));
+            this->settle();
+        }
+
+        void skip(){
+            this->path.back().second++;
+            this->settle();
+        }
+
+        void settle(){
+            while(!this->path.empty() && this->path.back().second >= this->path.back().first->count()){
+                this->path.pop_back();
+                if(!this->path.empty())
+                    this->path.back().second++;
+            }
+        }
+    };
+
+    //Whether two subtrees certainly hold the same entries: a page shared by
+    //a tree and its snapshot, or pages of the same id that are not loaded,
+    //whose subtrees are then exactly the files of that id. A loaded page
+    //may have changed children under it even when it is clean itself
+    static bool same(Page<Key, Value>* a, Page<Key, Value>* b){
+        if(a == b)
+            return true;
+        return !a->isOpen() && !b->isOpen() && a->getId() == b->getId();
+    }
 
 public:
     Btree(int order, Key sentinel, Value sentinelValue, bool memoryOnly = false){
@@ -26,24 +401,53 @@ public:
         this->root = new PageType(this->order, true);
         this->root->add(sentinel, sentinelValue);
         this->height = 1;
+        this->n = 0;
+        this->init();
+        this->sentinel = sentinel;
     }
 
+    //Opens the tree of the newest intact superblock, or of the meta file of
+    //a tree saved before superblocks
     Btree(std::string name){
         this->memoryOnly = false;
-        std::ifstream file;
-        std::string rootId;
-        file.open(name + ".meta.idx");
-        file >> this->order;
-        file >> this->height;
-        file >> this->n;
-        file >> rootId;
-        file.close();
+        Superblock super;
+        if(!Superblock::load(name, super)){
+            std::cout << "Error: no tree named " << name << std::endl;
+            assert(false);
+        }
+        this->order = super.order;
+        this->height = super.height;
+        this->n = super.n;
 
-        this->root = new PageType(rootId, this->order);
+        this->root = new PageType(super.rootId, this->order);
         this->root->open();
+        this->init();
+        this->sentinel = this->root->firstKey();
+        this->counting = super.counting;
+        this->summarized = Summary::ENABLED && super.summary == Summary::name();
+        this->prefetchHot(name);
+    }
+
+    //Point in time copy of the tree, to be deleted by the caller. Nothing is
+    //copied up front: both trees share every page and whichever modifies a
+    //shared page clones it first, so scans of the snapshot, including
+    //through its iterators, see the tree as it was while writers go on.
+    //The snapshot lives in memory; until the last snapshot is deleted save
+    //keeps the files of freed pages, which it may still have to load. Only
+    //this Btree object knows of its snapshots, another one opened on the
+    //same files does not.
+    //Loading a shared page is not synchronized, a snapshot and its tree
+    //used from different threads must share only loaded pages.
+    Btree* snapshot(){
+        //the rightmost leaf is now shared
+        this->appendLeaf = NULL;
+        this->catchUpSummaries();
+        return new Btree(this);
     }
 
     Value* get(Key key){
+        typename Tracer::Scope scope("get");
+        Stats::add(Stats::GETS);
         return this->get(this->root, key);
     }
 
@@ -59,6 +463,10 @@ public:
             if(toIndex >= 0 && toIndex < page->count()){
                 end = toIndex;
             }
+            //start reading every child in range before descending into the first
+            for(int i=begin; i<=end; i++){
+                page->getPageAt(i)->prefetch();
+            }
             for(int i=begin; i<=end; i++){
                 this->get(page->getPageAt(i), from, to, pages);
             }
@@ -77,28 +485,529 @@ public:
         return Iterator<Key, Value, Page<Key, Value>>(q, from, to);
     }
 
-    Value* get(Page<Key, Value>* page, Key key){
+    //Looks up a batch of keys one level at a time, prefetching all the
+    //children a level touches before any of them is opened
+    std::vector<Value*> get(const std::vector<Key>& keys){
+        Stats::add(Stats::GETS, keys.size());
+        std::vector<Page<Key, Value>*> at(keys.size(), this->root);
+        std::vector<bool> live(keys.size(), true);
+        for(int level=1; level<this->height; level++){
+            for(size_t i=0; i<keys.size(); i++){
+                at[i] = at[i]->next(keys[i]);
+                //leaves whose filter rules the key out are never read
+                if(level == this->height - 1 && !at[i]->mayContain(keys[i]))
+                    live[i] = false;
+            }
+            for(size_t i=0; i<keys.size(); i++){
+                if(live[i])
+                    at[i]->prefetch();
+            }
+        }
+        std::vector<Value*> values(keys.size(), NULL);
+        for(size_t i=0; i<keys.size(); i++){
+            if(live[i])
+                values[i] = at[i]->getValue(keys[i]);
+        }
+        return values;
+    }
+
+    //Runs up to width lookups side by side. Every step moves one lookup a
+    //level down and prefetches the page it lands on, then switches to the
+    //next lookup, so the cache misses (or page reads) of different lookups
+    //overlap instead of being paid one after the other.
+    std::vector<Value*> getInterleaved(const std::vector<Key>& keys, int width = 16){
+        Stats::add(Stats::GETS, keys.size());
+        //without a lane no lookup would run
+        if(width < 1)
+            width = 1;
+        struct Lane{
+            size_t index;
+            Page<Key, Value>* page;
+            bool touched;
+        };
+        std::vector<Value*> values(keys.size(), NULL);
+        std::vector<Lane> lanes;
+        size_t issued = 0;
+        for(; issued < keys.size() && (int)lanes.size() < width; issued++){
+            Lane lane = {issued, this->root, false};
+            lanes.push_back(lane);
+        }
+
+        size_t active = lanes.size();
+        while(active > 0){
+            for(size_t l=0; l<lanes.size(); l++){
+                Lane& lane = lanes[l];
+                if(lane.page == NULL)
+                    continue;
+                const Key& key = keys[lane.index];
+                if(!lane.touched){
+                    //the page object itself was prefetched on the previous hop
+                    if(lane.page->mayContain(key)){
+                        lane.page->prefetch();
+                        lane.touched = true;
+                        continue;
+                    }
+                } else if(lane.page->isExternal()){
+                    values[lane.index] = lane.page->getValue(key);
+                } else {
+                    Page<Key, Value>* next = lane.page->next(key);
+                    __builtin_prefetch(next);
+                    lane.page = next;
+                    lane.touched = false;
+                    continue;
+                }
+                //this lookup is done, start the next one in its lane
+                if(issued < keys.size()){
+                    lane.index = issued++;
+                    lane.page = this->root;
+                    lane.touched = false;
+                } else {
+                    lane.page = NULL;
+                    active--;
+                }
+            }
+        }
+        return values;
+    }
+
+    //Loads a passive page inside its own trace phase
+    void load(Page<Key, Value>* page, int level){
+        if(Tracer::ENABLED && !page->isOpen()){
+            typename Tracer::Scope scope("load", level);
+            page->open();
+        }
+    }
+
+    Value* get(Page<Key, Value>* page, Key key, int level = 0){
+        typename Tracer::Scope descent("descent", level);
+        this->load(page, level);
         if (page->isExternal()) {
+            typename Tracer::Scope search("search", level);
             return page->getValue(key);
         }
-        Page<Key, Value>* next = page->next(key);
-        return this->get(next, key);
+        Page<Key, Value>* next;
+        {
+            typename Tracer::Scope search("search", level);
+            next = page->next(key);
+        }
+        //a leaf filter answers most misses without loading the leaf
+        if (!next->mayContain(key)) {
+            return NULL;
+        }
+        return this->get(next, key, level + 1);
     }
 
     void put(Key key, Value value){
+        typename Tracer::Scope scope("put");
+        Stats::add(Stats::PUTS);
+        this->observe(key);
+        //a key past the end goes straight to the rightmost leaf while it
+        //has room, without descending from the root
+        if(this->appendLeaf != NULL && this->appendLeaf->lastKey() < key && this->appendLeaf->count() + 1 < (unsigned int)this->order){
+            this->appendLeaf->add(key, value);
+            this->n++;
+            //the counts and summaries on the rightmost path grow with the leaf
+            Page<Key, Value>* page = this->root;
+            while((this->counting || this->summarizing()) && page != this->appendLeaf){
+                unsigned int last = page->count() - 1;
+                if(this->counting)
+                    page->setCountAt(last, page->getCountAt(last) + 1);
+                if(this->summarizing())
+                    page->setSummaryAt(last, Summary::combine(*page->getSummaryAt(last), value));
+                page = page->getPageAt(last);
+            }
+            return;
+        }
+        this->appendLeaf = NULL;
+        this->ownRoot();
         this->put(this->root, key, value);
         this->n++;
-        if (this->root->isFull()) {
-            Page<Key, Value>* left = this->root;
-            Page<Key, Value>* right = this->root->split();
-            this->root = new PageType(this->order, false);
-            this->root->add(left->firstKey(), left);
-            this->root->add(right->firstKey(), right);
-            this->height++;
+        this->splitRoot(key, this->ascending >= SEQUENTIAL_RUN);
+        if(this->ascending > 0){
+            Page<Key, Value>* leaf = this->root;
+            while(!leaf->isExternal()){
+                leaf = leaf->lastPage();
+            }
+            if(!(key < leaf->lastKey()))
+                this->appendLeaf = leaf;
+        }
+    }
+
+    //Value of key, which is added with value first if it is missing. One
+    //descent finds or makes the slot, so the value can be read and changed
+    //in place through the pointer until the next modification of the tree
+    Value* getOrInsert(Key key, const Value& value, bool& inserted){
+        Value* slot = this->findOrInsert(key, value, inserted);
+        //the summaries cannot see changes made through the pointer, the path
+        //to key is summarized again before the next aggregate or save
+        if(this->summarizing())
+            this->handedOut.insert(key);
+        return slot;
+    }
+
+    Value* findOrInsert(Key key, const Value& value, bool& inserted){
+        typename Tracer::Scope scope("getOrInsert");
+        Stats::add(Stats::PUTS);
+        this->observe(key);
+        this->ownRoot();
+        Value* slot = this->findOrAdd(this->root, key, value, inserted);
+        if(!inserted)
+            return slot;
+        this->n++;
+        this->appendLeaf = NULL;
+        if(this->root->isFull()){
+            bool leaf = this->root->isExternal();
+            this->splitRoot(key, this->ascending >= SEQUENTIAL_RUN);
+            if(leaf)
+                slot = this->root->next(key)->getValue(key);
+        }
+        return slot;
+    }
+
+    Value* getOrInsert(Key key, const Value& value = Value()){
+        bool inserted;
+        return this->getOrInsert(key, value, inserted);
+    }
+
+    //Calls fn on the value of key in place, a missing key is added with a
+    //default value first. Returns whether the key was added
+    template<class Fn> bool upsert(Key key, Fn fn){
+        bool inserted;
+        Value* value = this->findOrInsert(key, Value(), inserted);
+        fn(*value);
+        this->resummarize(key);
+        return inserted;
+    }
+
+    //Sets key to desired if it is present with the value expected
+    bool compareAndSet(Key key, const Value& expected, const Value& desired){
+        typename Tracer::Scope scope("compareAndSet");
+        Stats::add(Stats::GETS);
+        Page<Key, Value>* page = this->root;
+        int level = 0;
+        this->load(page, level);
+        bool shared = page->isShared();
+        while(!page->isExternal()){
+            page = page->next(key);
+            if(!page->mayContain(key))
+                return false;
+            this->load(page, ++level);
+            shared = shared || page->isShared();
+        }
+        Value* value = page->getValue(key);
+        if(value == NULL || !(*value == expected))
+            return false;
+        if(shared)
+            page = this->ownPath(key);
+        bool inserted;
+        *page->findOrAdd(key, desired, inserted) = desired;
+        this->resummarize(key);
+        Stats::add(Stats::PUTS);
+        return true;
+    }
+
+    //With counting on, internal pages keep the number of entries under each
+    //child up to date, which rank, select and countRange need. Turning it on
+    //counts the whole tree once; the first of those calls does it otherwise.
+    void setCounting(bool counting){
+        if(counting && !this->counting)
+            this->countSubtree(this->root);
+        this->counting = counting;
+    }
+
+    //Number of keys below key, or at or below it with inclusive. Only the
+    //counts left of the path to key are added up
+    uint64_t rank(Key key, bool inclusive = false){
+        typename Tracer::Scope scope("rank");
+        Stats::add(Stats::GETS);
+        this->setCounting(true);
+        uint64_t below = 0;
+        Page<Key, Value>* page = this->root;
+        while(!page->isExternal()){
+            int index = page->getIndexOf(key);
+            if(index < 0)
+                index = 0;
+            for(int i=0; i<index; i++){
+                below += page->getCountAt(i);
+            }
+            page = page->getPageAt(index);
+        }
+        int index = page->getIndexOf(key);
+        if(index >= 0){
+            below += index + 1;
+            if(!inclusive && page->getKeyAt(index) == key)
+                below--;
+        }
+        //the sentinel is the smallest key and is not counted
+        if(below > 0)
+            below--;
+        return below;
+    }
+
+    //The key with k keys below it
+    Key select(uint64_t k){
+        typename Tracer::Scope scope("select");
+        Stats::add(Stats::GETS);
+        this->setCounting(true);
+        //the sentinel comes before every key
+        uint64_t position = k + 1;
+        Page<Key, Value>* page = this->root;
+        while(!page->isExternal()){
+            unsigned int i = 0;
+            while(i + 1 < page->count()){
+                uint64_t count = page->getCountAt(i);
+                if(position < count)
+                    break;
+                position -= count;
+                i++;
+            }
+            page = page->getPageAt(i);
+        }
+        if(position >= page->count()){
+            std::cout << "Error: no key at rank " << k << std::endl;
+            assert(false);
+            return Key();
+        }
+        return page->getKeyAt(position);
+    }
+
+    //Number of keys from from to to, both included
+    uint64_t countRange(Key from, Key to){
+        if(to < from)
+            return 0;
+        return this->rank(to, true) - this->rank(from);
+    }
+
+    //Summary of the values of the keys from from to to, both included. The
+    //children that lie inside the range give their stored summary, so only
+    //the pages at the two ends of the range are searched.
+    Value aggregate(Key from, Key to){
+        static_assert(Summary::ENABLED, "aggregate needs a Summary policy");
+        typename Tracer::Scope scope("aggregate");
+        Stats::add(Stats::GETS);
+        if(!this->summarized){
+            this->summarizeSubtree(this->root);
+            this->summarized = true;
+            this->handedOut.clear();
+        }
+        this->catchUpSummaries();
+        if(to < from)
+            return Summary::identity();
+        return this->aggregate(this->root, from, to, false, false);
+    }
+
+    //afterFrom and beforeTo tell that every key the page may hold is at or
+    //after from, or at or before to
+    Value aggregate(Page<Key, Value>* page, Key from, Key to, bool afterFrom, bool beforeTo){
+        Value summary = Summary::identity();
+        int i = page->getIndexOf(from);
+        if(page->isExternal()){
+            if(i < 0 || page->getKeyAt(i) < from)
+                i++;
+            for(; i<(int)page->count() && !(to < page->getKeyAt(i)); i++){
+                if(!(page->getKeyAt(i) == this->sentinel))
+                    summary = Summary::combine(summary, *page->getValueAt(i));
+            }
+            return summary;
+        }
+        if(i < 0)
+            i = 0;
+        for(; i<(int)page->count(); i++){
+            Key separator = page->getKeyAt(i);
+            if(i > 0 && to < separator)
+                break;
+            bool childAfterFrom = i == 0 ? afterFrom : !(separator < from);
+            bool childBeforeTo = i + 1 == (int)page->count() ? beforeTo : !(to < page->getKeyAt(i + 1));
+            if(childAfterFrom && childBeforeTo)
+                summary = Summary::combine(summary, *page->getSummaryAt(i));
+            else
+                summary = Summary::combine(summary, this->aggregate(page->getPageAt(i), from, to, childAfterFrom, childBeforeTo));
+        }
+        return summary;
+    }
+
+    //Calls fn(key, value) for every key from from to to, both included, on
+    //threads threads. The range is cut at the separators into subtrees,
+    //several per thread, and a thread that finishes one takes the next from
+    //the pool's queue, so a thread held up reading pages does not hold up
+    //the others. Keys of a leaf come in order, but fn is called from every
+    //thread at once and in no order across subtrees. Nothing may modify the
+    //tree until the scan returns.
+    template<class Fn> void parallelScan(Key from, Key to, Fn fn, int threads = 4){
+        typename Tracer::Scope scope("parallelScan");
+        if(to < from)
+            return;
+        std::vector<Page<Key, Value>*> subtrees(1, this->root);
+        for(int depth=0; depth<this->height - 1 && subtrees.size() < 8 * (size_t)threads; depth++){
+            std::vector<Page<Key, Value>*> next;
+            for(size_t i=0; i<subtrees.size(); i++){
+                this->scanChildren(subtrees[i], from, to, next);
+            }
+            subtrees.swap(next);
+        }
+        if(threads <= 1){
+            for(size_t i=0; i<subtrees.size(); i++){
+                this->scanSubtree(subtrees[i], from, to, fn);
+            }
+            return;
+        }
+        ThreadPool pool(threads);
+        for(size_t i=0; i<subtrees.size(); i++){
+            Page<Key, Value>* page = subtrees[i];
+            page->prefetch();
+            pool.submit([this, page, &from, &to, &fn]{
+                this->scanSubtree(page, from, to, fn);
+            });
+        }
+        pool.wait();
+    }
+
+    //Adds the children of an internal page that may hold keys of the range
+    void scanChildren(Page<Key, Value>* page, const Key& from, const Key& to, std::vector<Page<Key, Value>*>& children){
+        int begin = page->getIndexOf(from);
+        if(begin < 0)
+            begin = 0;
+        for(int i=begin; i<(int)page->count(); i++){
+            if(i > begin && to < page->getKeyAt(i))
+                break;
+            children.push_back(page->getPageAt(i));
+        }
+    }
+
+    template<class Fn> void scanSubtree(Page<Key, Value>* page, const Key& from, const Key& to, Fn& fn){
+        if(page->isExternal()){
+            int i = page->getIndexOf(from);
+            if(i < 0 || page->getKeyAt(i) < from)
+                i++;
+            for(; i<(int)page->count() && !(to < page->getKeyAt(i)); i++){
+                //the sentinel is not a key of the tree
+                if(!(page->getKeyAt(i) == this->sentinel))
+                    fn(page->getKeyAt(i), *page->getValueAt(i));
+            }
+            return;
+        }
+        std::vector<Page<Key, Value>*> children;
+        this->scanChildren(page, from, to, children);
+        //start reading every child in range before descending into the first
+        for(size_t i=0; i<children.size(); i++){
+            children[i]->prefetch();
+        }
+        for(size_t i=0; i<children.size(); i++){
+            this->scanSubtree(children[i], from, to, fn);
+        }
+    }
+
+    //Calls fn(key, inA, inB) in key order for every key whose entry differs
+    //between a and b, with NULL for the tree it is missing from. Both trees
+    //are walked side by side and subtrees they have in common are skipped
+    //without being read, see same(), so comparing a tree with its snapshot
+    //or two opens of saves that share pages costs the pages that differ.
+    template<class Fn> static void diff(const Btree& a, const Btree& b, Fn fn){
+        if(Btree::same(a.root, b.root))
+            return;
+        //the sentinels are not keys of the trees
+        auto report = [&](const Key& key, Value* inA, Value* inB){
+            if(inA != NULL && key == a.sentinel)
+                inA = NULL;
+            if(inB != NULL && key == b.sentinel)
+                inB = NULL;
+            if(inA != NULL || inB != NULL)
+                fn(key, inA, inB);
+        };
+        Cursor x(a.root, a.height);
+        Cursor y(b.root, b.height);
+        while(!x.atEnd() || !y.atEnd()){
+            if(x.atEnd() || y.atEnd()){
+                //what is left of one tree once the other is done
+                Cursor& rest = x.atEnd() ? y : x;
+                if(!rest.atEntry()){
+                    rest.descend();
+                    continue;
+                }
+                if(x.atEnd())
+                    report(y.key(), NULL, y.value());
+                else
+                    report(x.key(), x.value(), NULL);
+                rest.skip();
+            } else if(x.atEntry() && y.atEntry()){
+                Key kx = x.key();
+                Key ky = y.key();
+                if(kx < ky){
+                    report(kx, x.value(), NULL);
+                    x.skip();
+                } else if(ky < kx){
+                    report(ky, NULL, y.value());
+                    y.skip();
+                } else {
+                    if(!(*x.value() == *y.value()))
+                        report(kx, x.value(), y.value());
+                    x.skip();
+                    y.skip();
+                }
+            } else if(x.atEntry()){
+                //the subtree of b starts after the entry of a or holds it
+                if(x.key() < y.key()){
+                    report(x.key(), x.value(), NULL);
+                    x.skip();
+                } else {
+                    y.descend();
+                }
+            } else if(y.atEntry()){
+                if(y.key() < x.key()){
+                    report(y.key(), NULL, y.value());
+                    y.skip();
+                } else {
+                    x.descend();
+                }
+            } else if(Btree::same(x.subtree(), y.subtree())){
+                x.skip();
+                y.skip();
+            } else {
+                //open the subtree that starts first, or the taller one
+                Key kx = x.key();
+                Key ky = y.key();
+                if(kx < ky || (kx == ky && x.below() > y.below())){
+                    x.descend();
+                } else if(ky < kx || y.below() > x.below()){
+                    y.descend();
+                } else {
+                    x.descend();
+                    y.descend();
+                }
+            }
         }
     }
 
+    //Adds the entries of other, whose values win for keys in both trees.
+    //The entries that differ are found with diff, so merging in a tree
+    //that shares pages with this one, like a snapshot changed since or a
+    //reopened earlier save, reads only the pages that differ. They go in
+    //with one putBatch, or with bulkLoad if this tree is empty.
+    void mergeFrom(const Btree& other){
+        typename Tracer::Scope scope("mergeFrom");
+        std::vector<std::pair<Key, Value>> changes;
+        Btree::diff(*this, other, [&changes](const Key& key, Value* mine, Value* theirs){
+            if(theirs != NULL)
+                changes.push_back(std::make_pair(key, *theirs));
+        });
+        if(changes.empty())
+            return;
+        if(this->n == 0 && this->height == 1)
+            this->bulkLoad(changes);
+        else
+            this->putBatch(std::move(changes));
+    }
+
+    //Split policy for the puts from now on, SPLIT_MIDDLE by default
+    void setSplitPolicy(SplitPolicy policy){
+        this->splitPolicy = policy;
+    }
+
     void deleteKey(Key key){        
+        typename Tracer::Scope scope("delete");
+        Stats::add(Stats::DELETES);
+        this->appendLeaf = NULL;
+        this->ownRoot();
         this->deleteKey(this->root, key);
         this->n--;
 
@@ -106,86 +1015,773 @@ public:
             Page<Key, Value>* oldRoot = this->root;
             this->root = this->root->firstPage();
             oldRoot->detach();
-            delete oldRoot;
+            this->discard(oldRoot);
             this->height--;
+            Stats::add(Stats::ROOT_MERGES);
         }
     }
 
-    void put(Page<Key, Value>* page, Key key, Value value){
+    //Returns whether the key was new
+    bool put(Page<Key, Value>* page, Key key, Value value, int level = 0){
+        typename Tracer::Scope descent("descent", level);
+        this->load(page, level);
         if (page->isExternal()) {
+            typename Tracer::Scope search("search", level);
+            unsigned int size = page->count();
             page->add(key, value);
+            return page->count() > size;
+        }
+        Page<Key, Value>* next;
+        {
+            typename Tracer::Scope search("search", level);
+            next = this->ownNext(page, key);
+        }
+        bool added = this->put(next, key, value, level + 1);
+        if(added)
+            this->addCount(page, key, 1);
+        this->resummarize(page, next);
+        this->splitFull(page, next, key, this->ascending >= SEQUENTIAL_RUN, level + 1);
+        return added;
+    }
+
+    Value* findOrAdd(Page<Key, Value>* page, Key key, const Value& value, bool& inserted, int level = 0){
+        typename Tracer::Scope descent("descent", level);
+        this->load(page, level);
+        if (page->isExternal()) {
+            typename Tracer::Scope search("search", level);
+            return page->findOrAdd(key, value, inserted);
+        }
+        Page<Key, Value>* next;
+        {
+            typename Tracer::Scope search("search", level);
+            next = this->ownNext(page, key);
+        }
+        Value* slot = this->findOrAdd(next, key, value, inserted, level + 1);
+        if(inserted)
+            this->addCount(page, key, 1);
+        if(next->isFull()){
+            bool leaf = next->isExternal();
+            this->splitFull(page, next, key, this->ascending >= SEQUENTIAL_RUN, level + 1);
+            //the value moves when its leaf splits
+            if(leaf)
+                slot = page->next(key)->getValue(key);
+        }
+        return slot;
+    }
+
+    //Puts a batch of pairs. The batch is sorted, each leaf it goes to is
+    //reached once and takes all of its keys in one merge, and the pages
+    //that overflow are split afterwards. A repeated key keeps its last value.
+    void putBatch(std::vector<std::pair<Key, Value>> batch){
+        typename Tracer::Scope scope("putBatch");
+        Stats::add(Stats::PUTS, batch.size());
+        this->appendLeaf = NULL;
+        std::stable_sort(batch.begin(), batch.end(), [](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b){
+            return a.first < b.first;
+        });
+        size_t unique = 0;
+        for(size_t i=0; i<batch.size(); i++){
+            if(unique > 0 && !(batch[unique - 1].first < batch[i].first))
+                batch[unique - 1] = batch[i];
+            else
+                batch[unique++] = batch[i];
+        }
+        batch.resize(unique);
+
+        size_t next = 0;
+        while(next < batch.size()){
+            bool sequential = !(batch[next].first < this->root->lastKey());
+            this->ownRoot();
+            next = this->putBatch(this->root, batch, next, false, Key());
+            this->splitRoot(batch[next - 1].first, sequential);
+        }
+    }
+
+    //Adds the batch from begin on to the subtree of page, up to the first
+    //key that is not below upper or until page is full; returns where the
+    //batch continues
+    size_t putBatch(Page<Key, Value>* page, const std::vector<std::pair<Key, Value>>& batch, size_t begin, bool bounded, const Key& upper, int level = 0){
+        typename Tracer::Scope descent("descent", level);
+        this->load(page, level);
+        size_t end = batch.size();
+        if(bounded){
+            end = std::lower_bound(batch.begin() + begin, batch.end(), upper, [](const std::pair<Key, Value>& entry, const Key& key){
+                return entry.first < key;
+            }) - batch.begin();
+        }
+        if(page->isExternal()){
+            typename Tracer::Scope search("search", level);
+            unsigned int inserted;
+            //two pages' worth, so a single split brings it back in shape
+            unsigned int used = page->addSorted(&batch[begin], end - begin, 2 * (this->order - 1), inserted);
+            this->n += inserted;
+            return begin + used;
+        }
+        size_t i = begin;
+        while(i < end && !page->isFull()){
+            int index = page->getIndexOf(batch[i].first);
+            if(index < 0)
+                index = 0;
+            Page<Key, Value>* child = this->own(page, index);
+            bool childBounded = bounded;
+            Key childUpper = upper;
+            if(index + 1 < (int)page->count()){
+                childBounded = true;
+                childUpper = page->getKeyAt(index + 1);
+            }
+            //keys past the end of the child are appended to it
+            bool sequential = !(batch[i].first < child->lastKey());
+            size_t next = this->putBatch(child, batch, i, childBounded, childUpper, level + 1);
+            this->refresh(page, child);
+            this->splitFull(page, child, batch[next - 1].first, sequential, level + 1);
+            i = next;
+        }
+        return i;
+    }
+
+    //Builds the tree from pairs sorted by strictly ascending key, all above
+    //the sentinel; the tree must be empty. Leaves are cut from the input in
+    //runs of about order - 1 entries and filled on threads threads, then
+    //the interior levels are stitched over them. The pages are new, so a
+    //save(name, threads) afterwards writes them on threads as well.
+    void bulkLoad(const std::vector<std::pair<Key, Value>>& sorted, int threads = 4){
+        typename Tracer::Scope scope("bulkLoad");
+        if(this->n != 0 || this->height != 1){
+            std::cout << "Error: bulkLoad needs an empty tree" << std::endl;
+            assert(false);
+        }
+        if(sorted.empty())
+            return;
+        Stats::add(Stats::PUTS, sorted.size());
+        this->appendLeaf = NULL;
+        Value sentinelValue = *this->root->getValueAt(0);
+
+        //the sentinel goes first, the leaves share the rest evenly
+        size_t total = sorted.size() + 1;
+        size_t leaves = (total + this->order - 2) / (this->order - 1);
+        std::vector<Page<Key, Value>*> level(leaves);
+        std::atomic<bool> ordered(true);
+        auto fill = [&](size_t first, size_t last){
+            for(size_t l=first; l<last; l++){
+                size_t begin = l * total / leaves;
+                size_t end = (l + 1) * total / leaves;
+                Page<Key, Value>* leaf = new PageType(this->order, true);
+                if(begin == 0){
+                    leaf->add(this->sentinel, sentinelValue);
+                    begin = 1;
+                }
+                //entries past the sentinel are at one less in sorted
+                for(size_t i=begin; i<end; i++){
+                    const Key& previous = i == 1 ? this->sentinel : sorted[i - 2].first;
+                    if(!(previous < sorted[i - 1].first))
+                        ordered = false;
+                }
+                unsigned int inserted;
+                leaf->addSorted(&sorted[begin - 1], end - begin, this->order - 1, inserted);
+                level[l] = leaf;
+            }
+        };
+        if(threads <= 1 || leaves < 2){
+            fill(0, leaves);
+        } else {
+            ThreadPool pool(threads);
+            size_t chunk = (leaves + 4 * threads - 1) / (4 * threads);
+            for(size_t first=0; first<leaves; first+=chunk){
+                size_t last = std::min(first + chunk, leaves);
+                pool.submit([&fill, first, last]{ fill(first, last); });
+            }
+            pool.wait();
+        }
+        if(!ordered){
+            for(size_t l=0; l<leaves; l++){
+                Page<Key, Value>::release(level[l]);
+            }
+            std::cout << "Error: bulkLoad needs keys ascending above the sentinel" << std::endl;
+            assert(false);
             return;
         }
-        Page<Key, Value>* next = page->next(key);
-        this->put(next, key, value);
-        if (next->isFull()) {
-            Page<Key, Value>* split_page = next->split();
-            page->add(split_page->firstKey(), split_page);
+
+        int height = 1;
+        while(level.size() > 1){
+            size_t pages = (level.size() + this->order - 2) / (this->order - 1);
+            std::vector<Page<Key, Value>*> parents(pages);
+            for(size_t p=0; p<pages; p++){
+                Page<Key, Value>* parent = new PageType(this->order, false);
+                for(size_t c=p * level.size() / pages; c<(p + 1) * level.size() / pages; c++){
+                    parent->add(level[c]->firstKey(), level[c]);
+                    this->refresh(parent, level[c]);
+                }
+                parents[p] = parent;
+            }
+            level.swap(parents);
+            height++;
         }
+        this->discard(this->root);
+        this->root = level[0];
+        this->height = height;
+        this->n = sorted.size();
     }
 
-    void deleteKey(Page<Key, Value>* page, Key key){
+    //Returns whether the key was found
+    bool deleteKey(Page<Key, Value>* page, Key key, int level = 0){
+        typename Tracer::Scope descent("descent", level);
+        this->load(page, level);
         if (page->isExternal()) {
+            typename Tracer::Scope search("search", level);
+            unsigned int size = page->count();
             page->remove(key);
-            return;
+            return page->count() < size;
         }
 
-        Page<Key, Value>* next = page->next(key);
+        Page<Key, Value>* next;
+        {
+            typename Tracer::Scope search("search", level);
+            next = this->ownNext(page, key);
+        }
         Key nextPageKey = next->firstKey();
 
-        this->deleteKey(next, key);
+        bool removed = this->deleteKey(next, key, level + 1);
+        if(removed){
+            this->addCount(page, key, -1);
+            this->resummarize(page, next);
+        }
         if(key == nextPageKey){
             page->replaceKey(key, next->firstKey());
             nextPageKey = next->firstKey();
         }
         if (next->count() < this->order/2){
+            typename Tracer::Scope merge("merge", level + 1);
             //find the previous page
-            Page<Key, Value>* prev = page->prevPageOf(next);
+            int index = page->getIndexOf(nextPageKey);
+            Page<Key, Value>* prev = index > 0 ? this->own(page, index - 1) : NULL;
 
             if(prev != NULL){
                 page->remove(nextPageKey);
                 prev->merge(next);
-                delete next;
+                this->discard(next);
 
                 if (prev->isFull()) {
                     Page<Key, Value>* split_page = prev->split();
                     page->add(split_page->firstKey(), split_page);
+                    this->refresh(page, split_page);
                 }
+                this->refresh(page, prev);
             } else {
                 //find the next page
-                Page<Key, Value>* next_next = page->nextPageOf(next);
+                Page<Key, Value>* next_next = index + 1 < (int)page->count() ? this->own(page, index + 1) : NULL;
                 if (next_next != NULL){
                     page->remove(next_next->firstKey());
                     next->merge(next_next);
-                    delete next_next;
+                    this->discard(next_next);
+                    //a page the delete emptied starts with the keys it took
+                    if(!(next->firstKey() == nextPageKey))
+                        page->replaceKey(nextPageKey, next->firstKey());
                     
                     if (next->isFull()) {
                         Page<Key, Value>* split_page = next->split();
                         page->add(split_page->firstKey(), split_page);
+                        this->refresh(page, split_page);
                     }
+                    this->refresh(page, next);
                 } else {
                     std::cout << "Error: No previous or next page found" << std::endl;
                 }
             }
         }
+        return removed;
+    }
+
+    //Removes every key from from to to, both included, and returns how many
+    //were removed. Subtrees that lie inside the range are dropped whole,
+    //only the pages at its two ends are searched and trimmed. The sentinel
+    //the tree was created with is never removed.
+    unsigned int deleteRange(Key from, Key to){
+        return this->deleteRange(from, to, true);
+    }
+
+    //Removes every key before to
+    unsigned int truncatePrefix(Key to){
+        return this->deleteRange(this->root->firstKey(), to, false);
+    }
+
+    unsigned int deleteRange(Key from, Key to, bool inclusive){
+        typename Tracer::Scope scope("deleteRange");
+        this->appendLeaf = NULL;
+        if(to < from)
+            return 0;
+        std::vector<Key> trimmed;
+        this->ownRoot();
+        unsigned int removed = this->deleteRange(this->root, from, to, inclusive, false, false, true, trimmed);
+        this->n -= removed;
+        Stats::add(Stats::DELETES, removed);
+        //only the trimmed pages at the two ends of the range can be underfull
+        for(size_t i=0; i<trimmed.size(); i++){
+            this->rebalance(trimmed[i]);
+        }
+        return removed;
+    }
+
+    //afterFrom and beforeTo tell that every key the page may hold is at or
+    //after from, or inside to; leftmost marks the path to the sentinel. The
+    //first keys of the pages that were trimmed are added to trimmed.
+    unsigned int deleteRange(Page<Key, Value>* page, Key from, Key to, bool inclusive, bool afterFrom, bool beforeTo, bool leftmost, std::vector<Key>& trimmed){
+        if(page->isExternal()){
+            int first = page->getIndexOf(from);
+            if(first < 0 || page->getKeyAt(first) < from)
+                first++;
+            if(leftmost && first == 0)
+                first = 1;
+            int last = page->getIndexOf(to);
+            if(!inclusive && last >= 0 && !(page->getKeyAt(last) < to))
+                last--;
+            if(last < first)
+                return 0;
+            page->removeAt(first, last - first + 1);
+            return last - first + 1;
+        }
+
+        unsigned int removed = 0;
+        int i = page->getIndexOf(from);
+        if(i < 0)
+            i = 0;
+        while(i < (int)page->count()){
+            Key separator = page->getKeyAt(i);
+            if(i > 0 && (to < separator || (!inclusive && !(separator < to))))
+                break;
+            bool childAfterFrom = i == 0 ? afterFrom : !(separator < from);
+            bool childBeforeTo = i + 1 == (int)page->count() ? beforeTo : !(to < page->getKeyAt(i + 1));
+            if(childAfterFrom && childBeforeTo){
+                //this child and the ones after it that end inside the range
+                int end = i + 1;
+                while(end < (int)page->count() && (end + 1 == (int)page->count() ? beforeTo : !(to < page->getKeyAt(end + 1)))){
+                    end++;
+                }
+                for(int c=i; c<end; c++){
+                    removed += this->drop(page->getPageAt(c));
+                }
+                page->removeAt(i, end - i);
+                continue;
+            }
+            Page<Key, Value>* child = this->own(page, i);
+            removed += this->deleteRange(child, from, to, inclusive, childAfterFrom, childBeforeTo, leftmost && i == 0, trimmed);
+            if(child->count() == 0){
+                page->removeAt(i, 1);
+                this->discard(child);
+                continue;
+            }
+            if(separator < child->firstKey())
+                page->replaceKey(separator, child->firstKey());
+            this->refresh(page, child);
+            trimmed.push_back(child->firstKey());
+            i++;
+        }
+
+        return removed;
+    }
+
+    //Merges the underfull pages on the path to key with a neighbour, top
+    //down, so every page is fixed while its parent has other children. A
+    //merge takes a child from its parent, so the path is walked again until
+    //nothing changes.
+    void rebalance(Key key){
+        bool changed = true;
+        while(changed){
+            changed = false;
+            this->collapseRoot();
+            this->ownRoot();
+            Page<Key, Value>* page = this->root;
+            while(!page->isExternal()){
+                int index = page->getIndexOf(key);
+                if(index < 0)
+                    index = 0;
+                Page<Key, Value>* child = this->own(page, index);
+                while(child->count() < (unsigned int)this->order/2 && page->count() > 1){
+                    typename Tracer::Scope merge("merge");
+                    Page<Key, Value>* left = index > 0 ? this->own(page, index - 1) : child;
+                    Page<Key, Value>* right = index > 0 ? child : this->own(page, index + 1);
+                    page->remove(right->firstKey());
+                    left->merge(right);
+                    this->discard(right);
+                    if(left->isFull()){
+                        Page<Key, Value>* split_page = left->split();
+                        page->add(split_page->firstKey(), split_page);
+                        this->refresh(page, split_page);
+                    }
+                    this->refresh(page, left);
+                    changed = true;
+                    index = page->getIndexOf(key);
+                    if(index < 0)
+                        index = 0;
+                    child = this->own(page, index);
+                }
+                page = child;
+            }
+        }
+        this->collapseRoot();
+    }
+
+    //Replaces a root with a single child by that child
+    void collapseRoot(){
+        while(this->height > 1 && this->root->count() == 1){
+            this->ownRoot();
+            Page<Key, Value>* oldRoot = this->root;
+            this->root = this->root->firstPage();
+            oldRoot->detach();
+            this->discard(oldRoot);
+            this->height--;
+            Stats::add(Stats::ROOT_MERGES);
+        }
+    }
+
+    //Deletes a subtree, returns the number of entries its leaves held
+    unsigned int drop(Page<Key, Value>* page){
+        //a subtree a snapshot still reads is only let go of
+        if(page->isShared()){
+            unsigned int entries = this->forget(page);
+            Page<Key, Value>::release(page);
+            return entries;
+        }
+        unsigned int entries = 0;
+        if(page->isExternal()){
+            entries = page->count();
+        } else {
+            for(unsigned int i=0; i<page->count(); i++){
+                entries += this->drop(page->getPageAt(i));
+            }
+            page->detach();
+        }
+        this->discard(page);
+        return entries;
+    }
+
+    //Deletes a page that is no longer part of the tree and remembers its id
+    //so that the next save removes its files
+    void discard(Page<Key, Value>* page){
+        if(!this->memoryOnly)
+            this->freed.push_back(page->getId());
+        Page<Key, Value>::release(page);
     }
 
-    void save(std::string name){
+    //Incremental compaction. Every step visits one internal page and packs
+    //the entries of its children from left to right into pages filled to
+    //targetFill, dropping the pages that end up empty. Leaves are compacted
+    //first, then each interior level up to the root, and the position is
+    //kept as a key, so the steps can be interleaved with other operations.
+    //Runs at most maxSteps steps (0 runs to the end) and returns true once
+    //the pass over the tree is finished.
+    bool compact(unsigned int maxSteps = 0, double targetFill = 0.9){
+        if(targetFill <= 0 || targetFill > 1)
+            targetFill = 1;
+        unsigned int target = targetFill * (this->order - 1);
+        if(target < this->order/2)
+            target = this->order/2;
+        if(target < 1)
+            target = 1;
+        this->appendLeaf = NULL;
+        if(this->compactLevel == 0){
+            this->compactLevel = 1;
+            this->compactFrom = this->root->firstKey();
+        }
+        for(unsigned int step=0; maxSteps == 0 || step < maxSteps; step++){
+            typename Tracer::Scope scope("compact");
+            int depth = this->height - 1 - this->compactLevel;
+            if(depth < 0){
+                this->compactLevel = 0;
+                this->collapseRoot();
+                return true;
+            }
+
+            //the separator after the path is where the next step starts
+            this->ownRoot();
+            Page<Key, Value>* page = this->root;
+            bool bounded = false;
+            Key bound = this->compactFrom;
+            for(int level=0; level<depth; level++){
+                int index = page->getIndexOf(this->compactFrom);
+                if(index < 0)
+                    index = 0;
+                if(index + 1 < (int)page->count()){
+                    bounded = true;
+                    bound = page->getKeyAt(index + 1);
+                }
+                page = this->own(page, index);
+            }
+            this->coalesce(page, target);
+            //a page left with few children is merged with its neighbour
+            //before the next step, so the tree stays balanced in between
+            this->rebalance(this->compactFrom);
+
+            if(bounded){
+                this->compactFrom = bound;
+            } else {
+                this->compactLevel++;
+                this->compactFrom = this->root->firstKey();
+            }
+        }
+        return false;
+    }
+
+    void coalesce(Page<Key, Value>* page, unsigned int target){
+        unsigned int i = 0;
+        while(i + 1 < page->count()){
+            if(page->getPageAt(i)->count() >= target){
+                i++;
+                continue;
+            }
+            //left takes all of its right neighbour, or as much as fits
+            Page<Key, Value>* left = this->own(page, i);
+            Page<Key, Value>* right = this->own(page, i + 1);
+            right->open();
+            page->remove(page->getKeyAt(i + 1));
+            left->merge(right);
+            this->discard(right);
+            if(left->count() > target){
+                Page<Key, Value>* rest = left->split(target);
+                page->add(rest->firstKey(), rest);
+                this->refresh(page, rest);
+            }
+            this->refresh(page, left);
+        }
+        //a small remainder at the end shares the entries of its neighbour
+        unsigned int size = page->count();
+        if(size > 1 && page->getPageAt(size - 1)->count() < this->order/2){
+            Page<Key, Value>* left = this->own(page, size - 2);
+            Page<Key, Value>* last = this->own(page, size - 1);
+            last->open();
+            page->remove(page->getKeyAt(size - 1));
+            left->merge(last);
+            this->discard(last);
+            if(left->isFull()){
+                Page<Key, Value>* rest = left->split();
+                page->add(rest->firstKey(), rest);
+                this->refresh(page, rest);
+            }
+            this->refresh(page, left);
+        }
+    }
+
+    //Crash consistent save by shadow paging. The pages that changed are
+    //written to new files, never over the ones the last save left, and the
+    //superblock naming the new root commits them; only then are the files
+    //of the replaced pages removed. A save cut short anywhere leaves the
+    //previous tree intact. The pages are written on threads threads.
+    void save(std::string name, int threads = 1){
+        this->dropHot();
+        this->catchUpSummaries();
+        std::vector<std::string> relocated;
+        std::vector<Page<Key, Value>*> writes;
+        this->root->collect(&relocated, writes);
+        this->writePages(writes, threads);
+        PageFile::syncDirectory(name);
+
+        Superblock super;
+        super.sequence = Superblock::latest(name) + 1;
+        super.order = this->order;
+        super.height = this->height;
+        super.n = this->n;
+        super.rootId = this->root->getId();
+        super.counting = this->counting;
+        super.summary = this->summarized ? Summary::name() : "none";
+        if(!super.write(name)){
+            std::cout << "Error: could not commit " << name << std::endl;
+            return;
+        }
+        //the meta file is kept for tools that read it
         std::ofstream file;
         file.open(name + ".meta.idx");
-        file << this->order << std::endl;
-        file << this->height << std::endl;
-        file << this->n << std::endl;
-        file << this->root->getId() << std::endl;
+        file << super.fields();
         file.close();
+        this->recordHot(name);
+
+        this->freed.insert(this->freed.end(), relocated.begin(), relocated.end());
+        //the committed pages no longer reference the freed ones, but a live
+        //snapshot may
+        if(*this->snapshots > 0)
+            return;
+        for(size_t i=0; i<this->freed.size(); i++){
+            PageType::removeFiles(this->freed[i]);
+        }
+        this->freed.clear();
+    }
+
+    //Most pages save lists as hot, 0 stops recording them
+    void setHotPages(unsigned int pages){
+        this->hotPages = pages;
+    }
+
+    //Lists the pages in memory in <name>.hot.idx, the top levels first if
+    //there are more than hotPages. Only called once a save has committed,
+    //when every page in memory has its files
+    void recordHot(std::string name){
+        std::string path = name + ".hot.idx";
+        if(this->hotPages == 0){
+            std::remove(path.c_str());
+            return;
+        }
+        std::vector<std::string> ids;
+        std::vector<Page<Key, Value>*> level(1, this->root);
+        while(!level.empty() && ids.size() < this->hotPages){
+            std::vector<Page<Key, Value>*> next;
+            for(size_t i=0; i<level.size() && ids.size() < this->hotPages; i++){
+                Page<Key, Value>* page = level[i];
+                //the root is opened with the tree anyway
+                if(page != this->root)
+                    ids.push_back(page->getId());
+                if(page->isExternal())
+                    continue;
+                for(unsigned int c=0; c<page->count(); c++){
+                    if(page->getPageAt(c)->isOpen())
+                        next.push_back(page->getPageAt(c));
+                }
+            }
+            level.swap(next);
+        }
+        std::ofstream file(path, std::ios::trunc);
+        for(size_t i=0; i<ids.size(); i++){
+            file << ids[i] << std::endl;
+        }
+    }
+
+    //Starts reading the pages of <name>.hot.idx in the background, so the
+    //pages in memory at the last save are back after a restart without a
+    //miss each. Ids start with the time the page was created, sorting them
+    //reads the files roughly in the order they were laid out. Returns the
+    //number of pages requested
+    unsigned int prefetchHot(std::string name){
+        std::ifstream file(name + ".hot.idx");
+        if(!file.is_open())
+            return 0;
+        std::vector<std::string> ids;
+        std::string id;
+        while(ids.size() < this->hotPages && std::getline(file, id)){
+            if(!id.empty())
+                ids.push_back(id);
+        }
+        std::sort(ids.begin(), ids.end());
+        for(size_t i=0; i<ids.size(); i++){
+            Prefetcher::instance().prefetch(ids[i]);
+        }
+        this->hotPrefetched = ids;
+        return ids.size();
+    }
 
-        this->root->save();
+    //Drops the prefetched hot pages no open took, so that their bytes do
+    //not outlive the tree or its next save
+    void dropHot(){
+        for(size_t i=0; i<this->hotPrefetched.size(); i++){
+            Prefetcher::instance().drop(this->hotPrefetched[i]);
+        }
+        this->hotPrefetched.clear();
+    }
+
+    //Writes the files of pages, a few pages per task. No page is reachable
+    //from the superblock on disk until the save commits, so parents need
+    //not wait for their children
+    void writePages(const std::vector<Page<Key, Value>*>& pages, int threads){
+        if(threads <= 1 || pages.size() < 2){
+            for(size_t i=0; i<pages.size(); i++){
+                pages[i]->write();
+            }
+            return;
+        }
+        ThreadPool pool(threads);
+        size_t chunk = (pages.size() + 4 * threads - 1) / (4 * threads);
+        for(size_t begin=0; begin<pages.size(); begin+=chunk){
+            size_t end = std::min(begin + chunk, pages.size());
+            pool.submit([&pages, begin, end]{
+                for(size_t i=begin; i<end; i++){
+                    pages[i]->write();
+                }
+            });
+        }
+        pool.wait();
+    }
+
+    //Loads the top levels of the tree on threads threads, a level at a
+    //time, so the first lookups after opening a tree find them in memory.
+    //Returns the number of pages loaded
+    unsigned int warmUp(int levels, int threads = 4){
+        typename Tracer::Scope scope("warmUp");
+        std::vector<Page<Key, Value>*> level(1, this->root);
+        std::atomic<unsigned int> loaded(0);
+        ThreadPool pool(threads);
+        for(int depth=0; depth<levels && depth<this->height && !level.empty(); depth++){
+            for(size_t i=0; i<level.size(); i++){
+                Page<Key, Value>* page = level[i];
+                if(page->isOpen())
+                    continue;
+                pool.submit([page, &loaded]{
+                    page->open();
+                    loaded++;
+                });
+            }
+            pool.wait();
+            if(depth + 1 == levels || depth + 1 == this->height)
+                break;
+            std::vector<Page<Key, Value>*> next;
+            for(size_t i=0; i<level.size(); i++){
+                for(unsigned int c=0; c<level[i]->count(); c++){
+                    next.push_back(level[i]->getPageAt(c));
+                }
+            }
+            level.swap(next);
+        }
+        return loaded;
     }
 
     unsigned int count(){
         return this->n;
     }
 
+    //Process wide counters plus the shape of this tree; only pages already
+    //in memory are visited for the fill factor
+    Stats stats(){
+        Stats stats = Stats::collect();
+        stats.height = this->height;
+        stats.keys = this->n;
+        uint64_t keys = 0;
+        this->residentPages(this->root, stats.residentPages, keys);
+        if(stats.residentPages > 0)
+            stats.averageFill = (double)keys / (stats.residentPages * this->order);
+        return stats;
+    }
+
+    void residentPages(Page<Key, Value>* page, uint64_t& pages, uint64_t& keys){
+        if(!page->isOpen())
+            return;
+        pages++;
+        keys += page->count();
+        if(page->isExternal())
+            return;
+        for(unsigned int i=0; i<page->count(); i++){
+            this->residentPages(page->getPageAt(i), pages, keys);
+        }
+    }
+
+    //Calls fn(page, level) for every page, parents before children. With
+    //release, pages the walk had to load are closed again once their subtree
+    //is done, so a walk over a large on-disk tree keeps only one path loaded.
+    template<class Fn> void walk(Fn fn, bool release = false){
+        this->walk(this->root, 0, fn, release);
+    }
+
+    template<class Fn> void walk(Page<Key, Value>* page, int level, Fn& fn, bool release){
+        bool wasOpen = page->isOpen();
+        page->open();
+        fn(page, level);
+        if(!page->isExternal()){
+            for(unsigned int i=0; i<page->count(); i++){
+                this->walk(page->getPageAt(i), level + 1, fn, release);
+            }
+        }
+        if(release && !wasOpen)
+            page->close();
+    }
+
+    unsigned int get_order(){
+        return this->order;
+    }
+
     unsigned int get_height(){
         return this->height;
     }
@@ -205,8 +1801,11 @@ public:
 
 
     ~Btree(){
-        //Delete the root page
-        delete this->root;
+        this->dropHot();
+        if(this->isSnapshot)
+            (*this->snapshots)--;
+        //the pages are deleted with their last reference
+        Page<Key, Value>::release(this->root);
     }
 };
 
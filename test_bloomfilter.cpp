@@ -0,0 +1,84 @@
+#include <gtest/gtest.h>
+#include "BloomFilter.h"
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+
+TEST(BloomFilter, NoFalseNegatives){
+    BloomFilter filter(1000, 10);
+    for(int i=0; i<1000; i++){
+        filter.add(BloomFilter::hash(i));
+    }
+    for(int i=0; i<1000; i++){
+        EXPECT_TRUE(filter.mayContain(BloomFilter::hash(i)));
+    }
+    int falsePositives = 0;
+    for(int i=1000; i<11000; i++){
+        if(filter.mayContain(BloomFilter::hash(i)))
+            falsePositives++;
+    }
+    //about 1% is expected at 10 bits per key
+    EXPECT_LT(falsePositives, 300);
+}
+
+TEST(BloomFilter, EmptyFilterAcceptsEverything){
+    BloomFilter filter;
+    EXPECT_TRUE(filter.mayContain(BloomFilter::hash(std::string("anything"))));
+}
+
+TEST(BloomFilter, FilteredTreeLookups){
+    typedef CompoundObjectsFlatPage<std::string, std::string> PageType;
+    PageType::setFilterBitsPerKey(10);
+    Btree<std::string, std::string, PageType> btree(8, "", "");
+    for(int i=0; i<300; i += 2){
+        btree.put("key" + std::to_string(i), std::to_string(i));
+    }
+    btree.save("filter_tree");
+
+    Btree<std::string, std::string, PageType> loaded("filter_tree");
+    for(int i=0; i<300; i++){
+        std::string* value = loaded.get("key" + std::to_string(i));
+        if(i % 2 == 0){
+            ASSERT_NE(value, (std::string*)NULL);
+            EXPECT_EQ(*value, std::to_string(i));
+        } else {
+            EXPECT_EQ(value, (std::string*)NULL);
+        }
+    }
+
+    //keys added after loading must pass the resident filters
+    for(int i=1; i<300; i += 2){
+        loaded.put("key" + std::to_string(i), std::to_string(i));
+    }
+    for(int i=0; i<300; i++){
+        ASSERT_NE(loaded.get("key" + std::to_string(i)), (std::string*)NULL);
+    }
+    PageType::setFilterBitsPerKey(0);
+}
+
+TEST(BloomFilter, InsertsBeforeFirstProbeAfterReopen){
+    typedef FlatPage<int, int> PageType;
+    PageType::setFilterBitsPerKey(10);
+    {
+        Btree<int, int, PageType> btree(8, -1, -1);
+        for(int i=0; i<200; i += 2){
+            btree.put(i, i);
+        }
+        btree.save("filter_reopen_tree");
+    }
+    {
+        //the leaves are loaded by the puts, before any probe reads a filter
+        Btree<int, int, PageType> loaded("filter_reopen_tree");
+        for(int i=1; i<200; i += 2){
+            loaded.put(i, i);
+        }
+        for(int i=0; i<200; i++){
+            ASSERT_NE(loaded.get(i), (int*)NULL);
+        }
+        loaded.save("filter_reopen_tree");
+    }
+    Btree<int, int, PageType> reloaded("filter_reopen_tree");
+    for(int i=0; i<200; i++){
+        ASSERT_NE(reloaded.get(i), (int*)NULL);
+    }
+    PageType::setFilterBitsPerKey(0);
+}
@@ -1,7 +1,11 @@
 #include <gtest/gtest.h>
+#include <map>
+#include <set>
+#include <thread>
 #include "btree.h"
 #include "Iterator.h"
 #include "CompoundObjectsFlatPage.h"
+#include "KeyGenerator.h"
 
 // Define a fixture class for the B-tree tests
 class BtreeTest : public ::testing::Test {
@@ -45,6 +49,1007 @@ TEST_F(BtreeTest, GetRange) {
     ASSERT_TRUE(it.isEnd());
 }
 
+TEST(Btree, InterleavedGetMatchesGet) {
+    Btree<int, int, FlatPage<int, int>> btree(8, -1, -1, true);
+    for (int i = 0; i < 2000; i += 2) {
+        btree.put(i, i * 10);
+    }
+    std::vector<int> keys;
+    for (int i = 0; i < 2100; i++) {
+        keys.push_back((i * 7919) % 2100);
+    }
+    //a width below one runs the lookups one at a time
+    for (int width : {5, 1, 0, -3}) {
+        std::vector<int*> values = btree.getInterleaved(keys, width);
+        ASSERT_EQ(values.size(), keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            if (keys[i] < 2000 && keys[i] % 2 == 0) {
+                ASSERT_NE(values[i], (int*)NULL) << width;
+                EXPECT_EQ(*values[i], keys[i] * 10);
+            } else {
+                EXPECT_EQ(values[i], (int*)NULL);
+            }
+        }
+    }
+}
+
+TEST(Btree, StatsKeepCountsOfExitedThreads) {
+    Stats::reset();
+    for (int round = 0; round < 20; round++) {
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 8; t++) {
+            threads.push_back(std::thread([] {
+                Stats::add(Stats::PUTS, 2);
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) {
+            threads[t].join();
+        }
+    }
+    EXPECT_EQ(Stats::collect().puts, 320u);
+    Stats::reset();
+    EXPECT_EQ(Stats::collect().puts, 0u);
+}
+
+TEST(Btree, Stats) {
+    Stats::reset();
+    Btree<int, int, FlatPage<int, int>> btree(4, -1, -1);
+    for (int i = 0; i < 100; i++) {
+        btree.put(i, i);
+    }
+    for (int i = 0; i < 50; i++) {
+        btree.deleteKey(i);
+    }
+    btree.get(75);
+    Stats stats = btree.stats();
+    EXPECT_EQ(stats.puts, 100);
+    EXPECT_EQ(stats.deletes, 50);
+    EXPECT_EQ(stats.gets, 1);
+    EXPECT_GT(stats.splits, 0);
+    EXPECT_GT(stats.merges, 0);
+    EXPECT_GT(stats.rootSplits, 0);
+    EXPECT_EQ(stats.height, btree.get_height());
+    EXPECT_GT(stats.residentPages, 0);
+    EXPECT_GT(stats.averageFill, 0);
+
+    btree.save("stats_tree");
+    stats = Stats::collect();
+    EXPECT_EQ(stats.pageWrites, btree.stats().residentPages);
+    EXPECT_GT(stats.bytesWritten, 0);
+
+    Btree<int, int, FlatPage<int, int>> loaded("stats_tree");
+    loaded.get(75);
+    stats = loaded.stats();
+    EXPECT_EQ(stats.pageLoads, loaded.get_height());
+    EXPECT_GT(stats.bytesRead, 0);
+    EXPECT_EQ(stats.residentPages, loaded.get_height());
+    EXPECT_NE(stats.toJson().find("\"pageLoads\": " + std::to_string(stats.pageLoads)), std::string::npos);
+}
+
+TEST(Btree, WalkReleasesLoadedPages) {
+    Btree<int, int, FlatPage<int, int>> btree(4, -1, -1);
+    for (int i = 0; i < 200; i++) {
+        btree.put(i, i);
+    }
+    btree.save("walk_tree");
+
+    Btree<int, int, FlatPage<int, int>> loaded("walk_tree");
+    int pages = 0;
+    int keys = 0;
+    loaded.walk([&](Page<int, int>* page, int level) {
+        pages++;
+        if (page->isExternal())
+            keys += page->count();
+    }, true);
+    //the sentinel is stored like any other key
+    EXPECT_EQ(keys, 201);
+    EXPECT_GT(pages, loaded.get_height());
+    //only the root stays loaded
+    EXPECT_EQ(loaded.stats().residentPages, 1);
+    for (int i = 0; i < 200; i++) {
+        ASSERT_EQ(*loaded.get(i), i);
+    }
+}
+
+TEST(Btree, CompactCoalescesUnderfullPages) {
+    Btree<int, int, FlatPage<int, int>> btree(8, -1, -1);
+    for (int i = 0; i < 2000; i++) {
+        btree.put(i, i);
+    }
+    for (int i = 0; i < 2000; i++) {
+        if (i % 10 < 7)
+            btree.deleteKey(i);
+    }
+    btree.save("compact_tree");
+    uint64_t before = btree.stats().residentPages;
+    std::set<std::string> saved;
+    btree.walk([&](Page<int, int>* page, int level) {
+        saved.insert(page->getId());
+    });
+
+    //a bounded step does not finish the pass
+    EXPECT_FALSE(btree.compact(1));
+    btree.put(5000, 5000);
+    while (!btree.compact(4)) {
+    }
+    Stats stats = btree.stats();
+    EXPECT_LT(stats.residentPages, before);
+    EXPECT_GT(stats.averageFill, 0.6);
+
+    btree.save("compact_tree");
+    std::set<std::string> live;
+    btree.walk([&](Page<int, int>* page, int level) {
+        live.insert(page->getId());
+    });
+    //the files of pages dropped by compaction are gone
+    for (const std::string& id : saved) {
+        if (live.count(id) == 0) {
+            EXPECT_FALSE(PageFile::exists(id + ".idx"));
+            EXPECT_FALSE(PageFile::exists(id + ".values.idx"));
+        }
+    }
+
+    Btree<int, int, FlatPage<int, int>> loaded("compact_tree");
+    for (int i = 0; i < 2000; i++) {
+        if (i % 10 < 7)
+            ASSERT_EQ(loaded.get(i), nullptr);
+        else
+            ASSERT_EQ(*loaded.get(i), i);
+    }
+    EXPECT_EQ(*loaded.get(5000), 5000);
+}
+
+TEST(Btree, CompactTreeLoadedFromDisk) {
+    {
+        Btree<int, int, FlatPage<int, int>> btree(8, -1, -1);
+        for (int i = 0; i < 2000; i++) {
+            btree.put(i, i);
+        }
+        for (int i = 0; i < 2000; i++) {
+            if (i % 10 < 7)
+                btree.deleteKey(i);
+        }
+        btree.save("compact_disk_tree");
+    }
+    {
+        //the neighbours merged in are still on disk only
+        Btree<int, int, FlatPage<int, int>> loaded("compact_disk_tree");
+        loaded.compact();
+        for (int i = 0; i < 2000; i++) {
+            if (i % 10 < 7)
+                ASSERT_EQ(loaded.get(i), nullptr);
+            else
+                ASSERT_EQ(*loaded.get(i), i);
+        }
+    }
+    {
+        Btree<int, int, FlatPage<int, int>> loaded("compact_disk_tree");
+        loaded.put(206, 206);
+        loaded.deleteKey(1999);
+        loaded.compact();
+        loaded.save("compact_disk_tree");
+    }
+    Btree<int, int, FlatPage<int, int>> reloaded("compact_disk_tree");
+    for (int i = 0; i < 1999; i++) {
+        if (i % 10 < 7 && i != 206)
+            ASSERT_EQ(reloaded.get(i), nullptr);
+        else
+            ASSERT_EQ(*reloaded.get(i), i);
+    }
+    EXPECT_EQ(reloaded.get(1999), nullptr);
+}
+
+TEST(Btree, CompactCompoundTreeLoadedFromDisk) {
+    typedef Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> Tree;
+    {
+        Tree btree(8, "", "");
+        for (int i = 0; i < 1000; i++) {
+            btree.put("k" + std::to_string(i), "v" + std::to_string(i));
+        }
+        for (int i = 0; i < 1000; i++) {
+            if (i % 10 < 7)
+                btree.deleteKey("k" + std::to_string(i));
+        }
+        btree.save("compact_compound_tree");
+    }
+    Tree loaded("compact_compound_tree");
+    loaded.compact();
+    for (int i = 0; i < 1000; i++) {
+        if (i % 10 < 7)
+            ASSERT_EQ(loaded.get("k" + std::to_string(i)), nullptr);
+        else
+            ASSERT_EQ(*loaded.get("k" + std::to_string(i)), "v" + std::to_string(i));
+    }
+}
+
+TEST(Btree, AppendSplitPolicyKeepsPagesFull) {
+    Btree<int, int, FlatPage<int, int>> middle(16, -1, -1, true);
+    Btree<int, int, FlatPage<int, int>> append(16, -1, -1, true);
+    append.setSplitPolicy(SPLIT_APPEND_100);
+    for (int i = 0; i < 5000; i++) {
+        middle.put(i, i);
+        append.put(i, i);
+    }
+    EXPECT_LT(middle.stats().averageFill, 0.6);
+    //internal pages split in the middle under every policy
+    uint64_t leaves = 0;
+    uint64_t entries = 0;
+    append.walk([&](Page<int, int>* page, int level) {
+        if (page->isExternal()) {
+            leaves++;
+            entries += page->count();
+        }
+    });
+    EXPECT_GT((double)entries / (leaves * 16), 0.9);
+    EXPECT_LT(append.stats().residentPages, middle.stats().residentPages * 6 / 10);
+    for (int i = 0; i < 5000; i++) {
+        ASSERT_EQ(*append.get(i), i);
+    }
+}
+
+TEST(Btree, DeletesAfterAppendSplits) {
+    SplitPolicy policies[] = {SPLIT_MIDDLE, SPLIT_APPEND_90, SPLIT_APPEND_100, SPLIT_ADAPTIVE};
+    for (SplitPolicy policy : policies) {
+        Btree<int, int, FlatPage<int, int>> btree(6, -1, -1, true);
+        btree.setSplitPolicy(policy);
+        for (int i = 0; i < 100; i++) {
+            btree.put(i, i);
+        }
+        for (int i = 99; i >= 50; i--) {
+            btree.deleteKey(i);
+        }
+        //every internal page keeps two children and no page is left empty
+        btree.walk([&](Page<int, int>* page, int level) {
+            EXPECT_GT(page->count(), page->isExternal() ? 0u : 1u) << policy;
+        });
+        for (int i = 0; i < 100; i++) {
+            if (i < 50)
+                ASSERT_EQ(*btree.get(i), i) << policy;
+            else
+                ASSERT_EQ(btree.get(i), nullptr) << policy;
+        }
+    }
+}
+
+TEST(Btree, MixedPutsAndDeletesUnderEverySplitPolicy) {
+    SplitPolicy policies[] = {SPLIT_MIDDLE, SPLIT_APPEND_90, SPLIT_APPEND_100, SPLIT_ADAPTIVE};
+    for (SplitPolicy policy : policies) {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, true);
+        btree.setSplitPolicy(policy);
+        std::map<int, int> expected;
+        UniformGenerator random(3000, policy + 1);
+        int next = 0;
+        for (int round = 0; round < 20; round++) {
+            //an ascending run, then random keys, then random deletes
+            for (int i = 0; i < 100; i++, next++) {
+                btree.put(3000 + next, next);
+                expected[3000 + next] = next;
+            }
+            std::vector<std::pair<int, int>> batch;
+            for (int i = 0; i < 50; i++) {
+                int key = random.next();
+                batch.push_back(std::make_pair(key, round));
+                expected[key] = round;
+            }
+            btree.putBatch(batch);
+            for (int i = 0; i < 120; i++) {
+                std::map<int, int>::iterator it = expected.lower_bound(random.next() + (i % 2) * 3000);
+                if (it == expected.end())
+                    continue;
+                btree.deleteKey(it->first);
+                expected.erase(it);
+            }
+        }
+        for (int key = 0; key < 3000 + next; key++) {
+            std::map<int, int>::iterator it = expected.find(key);
+            if (it == expected.end())
+                ASSERT_EQ(btree.get(key), nullptr) << policy;
+            else
+                ASSERT_EQ(*btree.get(key), it->second) << policy;
+        }
+    }
+}
+
+TEST(Btree, AdaptiveSplitPolicy) {
+    Btree<int, int, FlatPage<int, int>> btree(16, -1, -1, true);
+    btree.setSplitPolicy(SPLIT_ADAPTIVE);
+    //random keys split in the middle
+    for (int i = 0; i < 2000; i++) {
+        btree.put((i * 7919) % 2000, i);
+    }
+    //then appends fill their pages
+    for (int i = 2000; i < 12000; i++) {
+        btree.put(i, i);
+    }
+    //and a few out of order keys land in the right places
+    btree.put(5000, -5);
+    btree.put(11999, -11999);
+    btree.put(12005, 12005);
+    btree.put(12001, 12001);
+    btree.deleteKey(12001);
+    btree.put(12002, 12002);
+    EXPECT_GT(btree.stats().averageFill, 0.8);
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_EQ(*btree.get((i * 7919) % 2000), i);
+    }
+    for (int i = 2000; i < 11999; i++) {
+        if (i != 5000)
+            ASSERT_EQ(*btree.get(i), i);
+    }
+    EXPECT_EQ(*btree.get(5000), -5);
+    EXPECT_EQ(*btree.get(11999), -11999);
+    EXPECT_EQ(btree.get(12001), nullptr);
+    EXPECT_EQ(*btree.get(12002), 12002);
+    EXPECT_EQ(*btree.get(12005), 12005);
+}
+
+TEST(Btree, DeleteRangeMatchesDeleteKey) {
+    Btree<int, int, FlatPage<int, int>> btree(6, -1, -1, true);
+    std::map<int, int> expected;
+    for (int i = 0; i < 3000; i++) {
+        btree.put(i * 2, i);
+        expected[i * 2] = i;
+    }
+    int ranges[][2] = {{100, 199}, {1000, 3001}, {3, 3}, {-5, 40}, {5000, 5998}, {2500, 5200}, {5990, 9000}};
+    for (auto& range : ranges) {
+        unsigned int removed = btree.deleteRange(range[0], range[1]);
+        unsigned int erased = 0;
+        for (auto it = expected.lower_bound(range[0]); it != expected.end() && it->first <= range[1];) {
+            it = expected.erase(it);
+            erased++;
+        }
+        ASSERT_EQ(removed, erased);
+    }
+    EXPECT_EQ(btree.count(), expected.size());
+    for (int i = -1; i < 6000; i++) {
+        if (i == -1 || expected.count(i))
+            ASSERT_NE(btree.get(i), nullptr) << i;
+        else
+            ASSERT_EQ(btree.get(i), nullptr) << i;
+    }
+    //the tree keeps working after the structure changed
+    for (int i = 0; i < 6000; i += 3) {
+        btree.put(i, i);
+    }
+    for (int i = 0; i < 6000; i += 3) {
+        ASSERT_EQ(*btree.get(i), i);
+    }
+}
+
+TEST(Btree, TruncatePrefixOnDisk) {
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(5, "", "");
+    char key[16];
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "k%04d", i);
+        btree.put(key, key);
+    }
+    btree.save("truncate_tree");
+
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> loaded("truncate_tree");
+    EXPECT_EQ(loaded.truncatePrefix("k0600"), 600);
+    EXPECT_EQ(loaded.count(), 400);
+    loaded.save("truncate_tree");
+
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> reloaded("truncate_tree");
+    for (int i = 0; i < 1000; i++) {
+        snprintf(key, sizeof(key), "k%04d", i);
+        if (i < 600)
+            ASSERT_EQ(reloaded.get(key), nullptr);
+        else
+            ASSERT_EQ(*reloaded.get(key), key);
+    }
+    EXPECT_EQ(reloaded.deleteRange("k0990", "k0999"), 10);
+    EXPECT_EQ(reloaded.get("k0995"), nullptr);
+    EXPECT_EQ(*reloaded.get("k0989"), "k0989");
+}
+
+TEST(Btree, PutBatchMatchesPut) {
+    SplitPolicy policies[] = {SPLIT_MIDDLE, SPLIT_APPEND_90, SPLIT_APPEND_100, SPLIT_ADAPTIVE};
+    for (SplitPolicy policy : policies) {
+        Btree<int, int, FlatPage<int, int>> btree(8, -1, -1, true);
+        btree.setSplitPolicy(policy);
+        std::map<int, int> expected;
+        UniformGenerator keys(20000, 7);
+        for (int round = 0; round < 20; round++) {
+            std::vector<std::pair<int, int>> batch;
+            for (int i = 0; i < 1000; i++) {
+                //every fourth round appends past the largest key
+                int key = round % 4 == 3 ? 20000 + round * 1000 + i : (int)keys.next();
+                batch.push_back(std::make_pair(key, round * 1000 + i));
+                expected[key] = round * 1000 + i;
+            }
+            btree.putBatch(batch);
+        }
+        EXPECT_EQ(btree.count(), expected.size());
+        for (auto& entry : expected) {
+            ASSERT_NE(btree.get(entry.first), nullptr) << entry.first;
+            ASSERT_EQ(*btree.get(entry.first), entry.second);
+        }
+        size_t entries = 0;
+        btree.walk([&](Page<int, int>* page, int level) {
+            EXPECT_LT(page->count(), 8u);
+            if (page->isExternal())
+                entries += page->count();
+        });
+        //the sentinel is stored like any other key
+        EXPECT_EQ(entries, expected.size() + 1);
+    }
+}
+
+TEST(Btree, PutBatchStrings) {
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(6, "", "", true);
+    std::vector<std::pair<std::string, std::string>> batch;
+    for (int i = 0; i < 500; i++) {
+        batch.push_back(std::make_pair("key" + std::to_string(i % 300), "value" + std::to_string(i)));
+    }
+    btree.putBatch(batch);
+    EXPECT_EQ(btree.count(), 300);
+    for (int i = 0; i < 300; i++) {
+        //a repeated key keeps the value given last
+        std::string value = "value" + std::to_string(i < 200 ? i + 300 : i);
+        ASSERT_EQ(*btree.get("key" + std::to_string(i)), value);
+    }
+}
+
+TEST(Btree, UpsertCountsInPlace) {
+    Btree<int, int, FlatPage<int, int>> btree(6, -1, -1, false);
+    std::map<int, int> expected;
+    UniformGenerator keys(500, 11);
+    for (int i = 0; i < 5000; i++) {
+        int key = (int)keys.next();
+        bool inserted = btree.upsert(key, [](int& count) { count++; });
+        EXPECT_EQ(inserted, expected.count(key) == 0);
+        expected[key]++;
+    }
+    EXPECT_EQ(btree.count(), expected.size());
+    btree.save("upsert");
+
+    //the in-place updates reach the disk
+    Btree<int, int, FlatPage<int, int>> reloaded("upsert");
+    for (auto& entry : expected) {
+        ASSERT_NE(reloaded.get(entry.first), nullptr) << entry.first;
+        ASSERT_EQ(*reloaded.get(entry.first), entry.second);
+    }
+}
+
+TEST(Btree, GetOrInsertSurvivesSplits) {
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(4, "", "", true);
+    for (int i = 0; i < 300; i++) {
+        std::string key = "key" + std::to_string(i * 7 % 300);
+        bool inserted;
+        std::string* value = btree.getOrInsert(key, "new", inserted);
+        ASSERT_TRUE(inserted);
+        //the slot is still right after the insert split its leaf
+        ASSERT_EQ(*value, "new");
+        value->append(key);
+    }
+    for (int i = 0; i < 300; i++) {
+        std::string key = "key" + std::to_string(i);
+        bool inserted;
+        EXPECT_EQ(*btree.getOrInsert(key, "other", inserted), "new" + key);
+        EXPECT_FALSE(inserted);
+    }
+    EXPECT_EQ(btree.count(), 300);
+}
+
+TEST(Btree, CompareAndSet) {
+    Btree<int, int, FlatPage<int, int>> btree(4, -1, -1, true);
+    for (int i = 0; i < 100; i++) {
+        btree.put(i, i);
+    }
+    EXPECT_TRUE(btree.compareAndSet(50, 50, 500));
+    EXPECT_EQ(*btree.get(50), 500);
+    EXPECT_FALSE(btree.compareAndSet(50, 50, 5000));
+    EXPECT_EQ(*btree.get(50), 500);
+    //a missing key is never set
+    EXPECT_FALSE(btree.compareAndSet(1000, 0, 1));
+    EXPECT_EQ(btree.get(1000), nullptr);
+}
+
+TEST(Btree, RankSelectAndCountRange) {
+    Btree<int, int, FlatPage<int, int>> btree(6, -1, -1, true);
+    std::set<int> expected;
+    UniformGenerator keys(10000, 13);
+    for (int i = 0; i < 3000; i++) {
+        int key = (int)keys.next();
+        btree.put(key, key);
+        expected.insert(key);
+    }
+    for (int i = 0; i < 1000; i++) {
+        int key = (int)keys.next();
+        btree.deleteKey(key);
+        expected.erase(key);
+    }
+    btree.deleteRange(2000, 2999);
+    expected.erase(expected.lower_bound(2000), expected.upper_bound(2999));
+
+    EXPECT_EQ(btree.rank(10000), expected.size());
+    uint64_t rank = 0;
+    for (int key : expected) {
+        ASSERT_EQ(btree.rank(key), rank);
+        ASSERT_EQ(btree.rank(key, true), rank + 1);
+        ASSERT_EQ(btree.select(rank), key);
+        rank++;
+    }
+    for (int from = 0; from < 10000; from += 777) {
+        int to = from + 1500;
+        uint64_t count = std::distance(expected.lower_bound(from), expected.upper_bound(to));
+        EXPECT_EQ(btree.countRange(from, to), count);
+    }
+    EXPECT_EQ(btree.countRange(5, 4), 0u);
+}
+
+TEST(Btree, SubtreeCountsOnDisk) {
+    {
+        Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(5, "", "", false);
+        for (int i = 0; i < 500; i++) {
+            char key[8];
+            snprintf(key, sizeof(key), "k%04d", i * 7 % 500);
+            btree.put(key, key);
+        }
+        btree.save("counts");
+    }
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> reloaded("counts");
+    EXPECT_EQ(reloaded.rank("k0250"), 250u);
+    EXPECT_EQ(reloaded.select(499), "k0499");
+    EXPECT_EQ(reloaded.countRange("k0100", "k0199"), 100u);
+}
+
+TEST(Btree, CountingStartsOnFirstUse) {
+    {
+        Btree<int, int, FlatPage<int, int>> btree(4, -1, -1, false);
+        for (int i = 0; i < 1000; i++) {
+            btree.put(i, i);
+        }
+        //the first rank counts the tree, the puts after it keep the counts
+        EXPECT_EQ(btree.rank(600), 600u);
+        for (int i = 1000; i < 1200; i++) {
+            btree.put(i, i);
+        }
+        btree.deleteRange(0, 99);
+        EXPECT_EQ(btree.select(0), 100);
+        btree.save("counting");
+    }
+    //the tree stays counted after it is reopened
+    Btree<int, int, FlatPage<int, int>> reloaded("counting");
+    for (int i = 1200; i < 1300; i++) {
+        reloaded.put(i, i);
+    }
+    EXPECT_EQ(reloaded.rank(5000), 1200u);
+    EXPECT_EQ(reloaded.countRange(1150, 1249), 100u);
+}
+
+template<class Summary> static void checkAggregate() {
+    typedef Btree<int, int, FlatPage<int, int>, NoTracer, Summary> Tree;
+    std::map<int, int> expected;
+    {
+        Tree btree(6, -1, -1, false);
+        UniformGenerator keys(5000, 17);
+        for (int i = 0; i < 3000; i++) {
+            int key = (int)keys.next();
+            btree.put(key, i % 1000);
+            expected[key] = i % 1000;
+        }
+        for (int i = 0; i < 500; i++) {
+            int key = (int)keys.next();
+            btree.deleteKey(key);
+            expected.erase(key);
+        }
+        btree.upsert(42, [](int& value) { value += 5000; });
+        expected[42] += 5000;
+        btree.save("aggregate");
+    }
+    Tree btree("aggregate");
+    for (int from = -10; from < 5000; from += 317) {
+        int to = from + 400;
+        int value = Summary::identity();
+        for (auto it = expected.lower_bound(from); it != expected.end() && it->first <= to; ++it) {
+            value = Summary::combine(value, it->second);
+        }
+        EXPECT_EQ(btree.aggregate(from, to), value) << from;
+    }
+    EXPECT_EQ(btree.aggregate(10, 9), Summary::identity());
+}
+
+TEST(Btree, AggregateSum) {
+    checkAggregate<SumSummary<int>>();
+}
+
+TEST(Btree, AggregateMinAndMax) {
+    checkAggregate<MinSummary<int>>();
+    checkAggregate<MaxSummary<int>>();
+}
+
+TEST(Btree, AggregateAfterGetOrInsertLoadsOnlyPaths) {
+    typedef Btree<int, int, FlatPage<int, int>, NoTracer, SumSummary<int>> Tree;
+    {
+        Tree btree(6, -1, -1, false);
+        for (int i = 0; i < 3000; i++) {
+            btree.put(i, 1);
+        }
+        btree.save("handed_out");
+    }
+    for (int round = 0; round < 2; round++) {
+        Tree btree("handed_out");
+        Prefetcher::instance().clear();
+        Stats before = Stats::collect();
+        *btree.getOrInsert(1500) += 10;
+        *btree.getOrInsert(4000) += 7;
+        //the paths to the handed out keys are summarized again, not the tree
+        EXPECT_EQ(btree.aggregate(1490, 1510), 21 + 10 * (round + 1));
+        EXPECT_EQ(btree.aggregate(3990, 4010), 7 * (round + 1));
+        Stats after = Stats::collect();
+        EXPECT_LE(after.pageLoads - before.pageLoads, 4 * btree.get_height());
+        //the summaries stay valid on disk for the next open
+        btree.save("handed_out");
+    }
+    Tree btree("handed_out");
+    EXPECT_EQ(btree.aggregate(0, 5000), 3000 + 20 + 14);
+}
+
+TEST(Btree, AggregateSummarizesUnsummarizedTree) {
+    {
+        Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(5, "", "", false);
+        for (int i = 0; i < 300; i++) {
+            btree.put("k" + std::to_string(1000 + i), "v" + std::to_string(i * 37 % 300));
+        }
+        btree.save("summaries");
+    }
+    //saved without summaries, they are computed on the first aggregate
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>, NoTracer, MaxSummary<std::string>> btree("summaries");
+    EXPECT_EQ(btree.aggregate("k1000", "k1299"), "v99");
+    btree.put("k1300", "w");
+    EXPECT_EQ(btree.aggregate("k1200", "k1300"), "w");
+    EXPECT_EQ(btree.aggregate("k1000", "k1002"), "v74");
+}
+
+TEST(Btree, SnapshotIsPointInTime) {
+    Btree<int, int, FlatPage<int, int>> btree(6, -1, -1, true);
+    for (int i = 0; i < 3000; i++) {
+        btree.put(i, i);
+    }
+    Btree<int, int, FlatPage<int, int>>* snapshot = btree.snapshot();
+    auto it = snapshot->get(0, 2999);
+    //the writer splits, merges and drops the pages the iterator is on
+    for (int i = 3000; i < 4000; i++) {
+        btree.put(i, i);
+    }
+    for (int i = 0; i < 3000; i += 2) {
+        btree.put(i, -i);
+    }
+    btree.deleteRange(1000, 1999);
+    for (int i = 2001; i < 3000; i += 4) {
+        btree.deleteKey(i);
+    }
+    std::vector<std::pair<int, int>> batch;
+    for (int i = 0; i < 500; i++) {
+        batch.push_back(std::make_pair(i * 7 + 1, 1));
+    }
+    btree.putBatch(batch);
+    btree.compact();
+
+    int expected = 0;
+    while (!it.isEnd()) {
+        ASSERT_EQ(**it, expected);
+        it++;
+        expected++;
+    }
+    EXPECT_EQ(expected, 3000);
+    EXPECT_EQ(snapshot->count(), 3000);
+    EXPECT_EQ(*btree.get(2), -2);
+    EXPECT_EQ(btree.get(1500), nullptr);
+    EXPECT_EQ(*btree.get(3500), 3500);
+
+    //writes to the snapshot do not reach the tree either
+    snapshot->deleteRange(0, 999);
+    snapshot->put(1500, 1);
+    EXPECT_EQ(*btree.get(2), -2);
+    EXPECT_EQ(btree.get(1500), nullptr);
+    delete snapshot;
+    EXPECT_EQ(*btree.get(8), 1);
+    EXPECT_EQ(*btree.get(3999), 3999);
+}
+
+TEST(Btree, SnapshotKeepsFreedPagesOnDisk) {
+    {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+        for (int i = 0; i < 2000; i++) {
+            btree.put(i, i);
+        }
+        btree.save("snapshot_tree");
+    }
+    std::string rootId;
+    {
+        int order, height, n;
+        std::ifstream meta("snapshot_tree.meta.idx");
+        meta >> order >> height >> n >> rootId;
+    }
+    Btree<int, int, FlatPage<int, int>> btree("snapshot_tree");
+    Btree<int, int, FlatPage<int, int>>* snapshot = btree.snapshot();
+    //the tree clones the shared root and drops subtrees of the snapshot
+    btree.deleteRange(0, 1499);
+    btree.put(1600, -1);
+    btree.save("snapshot_tree");
+    EXPECT_TRUE(PageFile::exists(rootId + ".idx"));
+    for (int i = 0; i < 2000; i++) {
+        ASSERT_EQ(*snapshot->get(i), i);
+    }
+    delete snapshot;
+    btree.save("snapshot_tree");
+    EXPECT_FALSE(PageFile::exists(rootId + ".idx"));
+
+    Btree<int, int, FlatPage<int, int>> reloaded("snapshot_tree");
+    EXPECT_EQ(reloaded.get(10), nullptr);
+    EXPECT_EQ(*reloaded.get(1600), -1);
+    EXPECT_EQ(*reloaded.get(1999), 1999);
+}
+
+TEST(Btree, ParallelSave) {
+    typedef Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> Tree;
+    {
+        Tree btree(6, "", "");
+        for (int i = 0; i < 3000; i++) {
+            btree.put("k" + std::to_string(i), "v" + std::to_string(i));
+        }
+        btree.save("parallel_tree", 4);
+    }
+    {
+        Tree loaded("parallel_tree");
+        for (int i = 0; i < 3000; i += 5) {
+            loaded.put("k" + std::to_string(i), "w" + std::to_string(i));
+        }
+        //the changed paths move to new files, on several threads too
+        loaded.save("parallel_tree", 4);
+    }
+    Tree reloaded("parallel_tree");
+    EXPECT_EQ(reloaded.count(), 3600);
+    for (int i = 0; i < 3000; i++) {
+        ASSERT_EQ(*reloaded.get("k" + std::to_string(i)), (i % 5 == 0 ? "w" : "v") + std::to_string(i));
+    }
+}
+
+TEST(Btree, WarmUpLoadsTopLevels) {
+    {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+        for (int i = 0; i < 5000; i++) {
+            btree.put(i, i);
+        }
+        btree.save("warm_tree");
+    }
+    Btree<int, int, FlatPage<int, int>> btree("warm_tree");
+    ASSERT_GT(btree.get_height(), 3u);
+    unsigned int top = 1;
+    btree.walk([&](Page<int, int>* page, int level) {
+        if (level == 1)
+            top++;
+    }, true);
+    //the root is open already
+    EXPECT_EQ(btree.warmUp(2, 4), top - 1);
+    EXPECT_EQ(btree.stats().residentPages, top);
+    EXPECT_EQ(btree.warmUp(2, 4), 0u);
+    EXPECT_EQ(*btree.get(4321), 4321);
+}
+
+TEST(Btree, ParallelScan) {
+    std::vector<std::atomic<int>> seen(20000);
+    for (size_t i = 0; i < seen.size(); i++) {
+        seen[i] = 0;
+    }
+    {
+        Btree<int, int, FlatPage<int, int>> btree(6, -1, -1);
+        for (int i = 0; i < 20000; i++) {
+            btree.put(i, 2 * i);
+        }
+        std::atomic<long> sum(0);
+        btree.parallelScan(100, 14999, [&](int key, int& value) {
+            seen[key]++;
+            sum += value;
+        }, 4);
+        for (int i = 0; i < 20000; i++) {
+            ASSERT_EQ(seen[i], i >= 100 && i < 15000 ? 1 : 0);
+        }
+        EXPECT_EQ(sum, 2L * (14999L * 15000 / 2 - 99L * 100 / 2));
+        btree.parallelScan(10, 5, [&](int key, int& value) {
+            seen[key]++;
+        }, 4);
+        EXPECT_EQ(seen[7], 0);
+        btree.save("scan_tree");
+    }
+    //the subtrees are read from disk on the threads
+    Btree<int, int, FlatPage<int, int>> cold("scan_tree");
+    Prefetcher::instance().clear();
+    std::atomic<long> count(0);
+    std::atomic<long> sum(0);
+    cold.parallelScan(-1000, 100000, [&](int key, int& value) {
+        count++;
+        sum += key;
+    }, 8);
+    EXPECT_EQ(count, 20000);
+    EXPECT_EQ(sum, 19999L * 20000 / 2);
+}
+
+TEST(Btree, BulkLoad) {
+    std::vector<std::pair<int, int>> sorted;
+    for (int i = 0; i < 50000; i++) {
+        sorted.push_back(std::make_pair(3 * i, i));
+    }
+    {
+        Btree<int, int, FlatPage<int, int>> btree(8, -1, -1);
+        btree.setCounting(true);
+        btree.bulkLoad(sorted, 4);
+        EXPECT_EQ(btree.count(), 50000);
+        EXPECT_EQ(btree.rank(30000), 10000u);
+        EXPECT_EQ(btree.countRange(0, 299), 100u);
+        for (int i = 0; i < 50000; i++) {
+            ASSERT_EQ(*btree.get(3 * i), i);
+            ASSERT_EQ(btree.get(3 * i + 1), (int*)NULL);
+        }
+        //the built tree takes puts and deletes like any other
+        for (int i = 0; i < 3000; i++) {
+            btree.put(3 * i + 1, -i);
+            btree.deleteKey(3 * i);
+        }
+        btree.save("bulk_tree", 4);
+    }
+    Btree<int, int, FlatPage<int, int>> loaded("bulk_tree");
+    EXPECT_EQ(loaded.count(), 50000);
+    for (int i = 0; i < 50000; i++) {
+        ASSERT_EQ(loaded.get(3 * i) == NULL, i < 3000);
+    }
+    EXPECT_EQ(*loaded.get(3 * 2999 + 1), -2999);
+}
+
+TEST(Btree, BulkLoadStrings) {
+    std::vector<std::pair<std::string, std::string>> sorted;
+    char key[16];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(key, sizeof(key), "k%06d", i);
+        sorted.push_back(std::make_pair(std::string(key), "v" + std::to_string(i)));
+    }
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> btree(10, "", "");
+    btree.bulkLoad(sorted, 3);
+    EXPECT_EQ(btree.count(), 5000);
+    btree.put("k000000a", "x");
+    Iterator<std::string, std::string, Page<std::string, std::string>> it = btree.get("k000000", "k000001");
+    EXPECT_EQ(**it, "v0");
+    it++;
+    EXPECT_EQ(**it, "x");
+    it++;
+    EXPECT_EQ(**it, "v1");
+    //a tree of one leaf
+    Btree<std::string, std::string, CompoundObjectsFlatPage<std::string, std::string>> small(10, "", "");
+    sorted.resize(5);
+    small.bulkLoad(sorted, 3);
+    EXPECT_EQ(small.get_height(), 1u);
+    EXPECT_EQ(*small.get("k000004"), "v4");
+}
+
+TEST(Btree, DiffWithSnapshot) {
+    typedef Btree<int, int, FlatPage<int, int>> Tree;
+    Tree btree(6, -1, -1, true);
+    std::map<int, int> before;
+    UniformGenerator keys(40000, 7);
+    for (int i = 0; i < 10000; i++) {
+        int key = keys.next();
+        btree.put(key, i);
+        before[key] = i;
+    }
+    Tree* snapshot = btree.snapshot();
+    std::map<int, int> after = before;
+    for (int i = 0; i < 300; i++) {
+        int key = keys.next();
+        if (i % 3 == 0) {
+            if (after.count(key)) {
+                btree.deleteKey(key);
+                after.erase(key);
+            }
+        } else {
+            btree.put(key, -i);
+            after[key] = -i;
+        }
+    }
+    std::vector<int> expected;
+    for (std::map<int, int>::iterator it = before.begin(); it != before.end(); ++it) {
+        if (!after.count(it->first) || after[it->first] != it->second)
+            expected.push_back(it->first);
+    }
+    for (std::map<int, int>::iterator it = after.begin(); it != after.end(); ++it) {
+        if (!before.count(it->first))
+            expected.push_back(it->first);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<int> found;
+    Tree::diff(*snapshot, btree, [&](int key, int* old, int* now) {
+        found.push_back(key);
+        ASSERT_EQ(old == NULL, before.count(key) == 0);
+        ASSERT_EQ(now == NULL, after.count(key) == 0);
+        if (old != NULL)
+            ASSERT_EQ(*old, before[key]);
+        if (now != NULL)
+            ASSERT_EQ(*now, after[key]);
+    });
+    EXPECT_EQ(found, expected);
+
+    //the other way round the roles swap
+    unsigned int reversed = 0;
+    Tree::diff(btree, *snapshot, [&](int key, int* old, int* now) {
+        reversed++;
+    });
+    EXPECT_EQ(reversed, expected.size());
+    delete snapshot;
+}
+
+TEST(Btree, DiffReadsOnlyChangedPages) {
+    typedef Btree<int, int, FlatPage<int, int>> Tree;
+    {
+        Tree btree(8, -1, -1);
+        for (int i = 0; i < 20000; i++) {
+            btree.put(i, i);
+        }
+        btree.setHotPages(0);
+        btree.save("diff_tree");
+    }
+    Tree a("diff_tree");
+    Tree b("diff_tree");
+    b.put(100, -1);
+    b.put(15000, -1);
+    b.deleteKey(9000);
+    Stats before = Stats::collect();
+    std::vector<int> found;
+    Tree::diff(a, b, [&](int key, int* old, int* now) {
+        found.push_back(key);
+    });
+    Stats after = Stats::collect();
+    EXPECT_EQ(found, std::vector<int>({100, 9000, 15000}));
+    //a reads its side of the pages b loaded and of those b merged away,
+    //out of some four thousand
+    EXPECT_LE(after.pageLoads - before.pageLoads, 2 * b.stats().residentPages);
+}
+
+TEST(Btree, MergeFrom) {
+    typedef Btree<int, int, FlatPage<int, int>> Tree;
+    Tree main(6, -1, -1, true);
+    for (int i = 0; i < 6000; i += 2) {
+        main.put(i, i);
+    }
+    Tree delta(6, -1, -1, true);
+    for (int i = 0; i < 9000; i += 3) {
+        delta.put(i, -i);
+    }
+    main.mergeFrom(delta);
+    EXPECT_EQ(main.count(), 3000 + 3000 - 1000);
+    for (int i = 0; i < 9000; i++) {
+        int* value = main.get(i);
+        if (i % 3 == 0)
+            ASSERT_EQ(*value, -i);
+        else if (i % 2 == 0 && i < 6000)
+            ASSERT_EQ(*value, i);
+        else
+            ASSERT_EQ(value, (int*)NULL);
+    }
+
+    //an empty tree is bulk loaded
+    Tree copy(6, -1, -1, true);
+    copy.mergeFrom(delta);
+    EXPECT_EQ(copy.count(), 3000);
+    unsigned int differences = 0;
+    Tree::diff(copy, delta, [&](int key, int* a, int* b) {
+        differences++;
+    });
+    EXPECT_EQ(differences, 0u);
+
+    //a delta started as a snapshot brings only its changes
+    Tree* next = main.snapshot();
+    next->put(1, 1);
+    next->put(8999, 8999);
+    main.mergeFrom(*next);
+    EXPECT_EQ(main.count(), 5002);
+    EXPECT_EQ(*main.get(1), 1);
+    EXPECT_EQ(*main.get(8999), 8999);
+    delete next;
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
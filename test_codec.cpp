@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "Codec.h"
+#include "PageFile.h"
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+
+static std::string roundTrip(Codec* codec, const std::string& in){
+    std::string stored;
+    codec->compress(in.data(), in.size(), stored);
+    std::string out(in.size(), '\0');
+    EXPECT_TRUE(codec->decompress(stored.data(), stored.size(), &out[0], in.size()));
+    return out;
+}
+
+TEST(Codec, LZRoundTrip){
+    LZCodec codec;
+    std::string text;
+    for(int i=0; i<1000; i++){
+        text += "key_" + std::to_string(i % 37) + "=value_" + std::to_string(i);
+    }
+    EXPECT_EQ(roundTrip(&codec, text), text);
+    EXPECT_EQ(roundTrip(&codec, ""), "");
+    EXPECT_EQ(roundTrip(&codec, "abc"), "abc");
+    EXPECT_EQ(roundTrip(&codec, std::string(100000, 'x')), std::string(100000, 'x'));
+
+    std::string random;
+    for(int i=0; i<5000; i++){
+        random.push_back((char)(rand() & 0xff));
+    }
+    EXPECT_EQ(roundTrip(&codec, random), random);
+}
+
+TEST(Codec, LZCompressesText){
+    LZCodec codec;
+    std::string text;
+    for(int i=0; i<1000; i++){
+        text += "customer/" + std::to_string(i) + "/profile";
+    }
+    std::string stored;
+    codec.compress(text.data(), text.size(), stored);
+    EXPECT_LT(stored.size(), text.size() / 2);
+}
+
+TEST(Codec, LZRejectsCorruptInput){
+    LZCodec codec;
+    std::string text(1000, 'a');
+    std::string stored;
+    codec.compress(text.data(), text.size(), stored);
+    std::string out(text.size(), '\0');
+    EXPECT_FALSE(codec.decompress(stored.data(), stored.size() - 1, &out[0], text.size()));
+    EXPECT_FALSE(codec.decompress(stored.data(), stored.size(), &out[0], text.size() - 1));
+}
+
+TEST(Codec, CompressedTreeSaveAndOpen){
+    typedef CompoundObjectsFlatPage<std::string, std::string> PageType;
+    PageType::setCodec(Codec::forTag(LZCodec::TAG));
+    Btree<std::string, std::string, PageType> btree(8, "", "");
+    for(int i=0; i<200; i++){
+        btree.put("user:" + std::to_string(i), "https://example.com/users/" + std::to_string(i));
+    }
+    btree.save("codec_tree");
+    PageType::setCodec(NULL);
+
+    Btree<std::string, std::string, PageType> loaded("codec_tree");
+    for(int i=0; i<200; i++){
+        ASSERT_NE(loaded.get("user:" + std::to_string(i)), (std::string*)NULL);
+        EXPECT_EQ(*loaded.get("user:" + std::to_string(i)), "https://example.com/users/" + std::to_string(i));
+    }
+}
+
+static std::string readAll(const std::string& path){
+    std::ifstream file(path, std::ios::binary);
+    std::ostringstream data;
+    data << file.rdbuf();
+    return data.str();
+}
+
+TEST(PageFile, ChecksumCatchesCorruption){
+    std::string payload(4000, 'p');
+    ASSERT_TRUE(PageFile::write("checksum.values.idx", payload, NULL));
+    std::string read;
+    ASSERT_TRUE(PageFile::read("checksum.values.idx", read));
+    EXPECT_EQ(read, payload);
+
+    //one flipped bit anywhere in the payload or the header fails the read
+    std::string bytes = readAll("checksum.values.idx");
+    size_t offsets[] = {bytes.size() - 1, bytes.size() / 2, 5};
+    for(size_t offset : offsets){
+        std::string corrupt = bytes;
+        corrupt[offset] ^= 0x10;
+        std::ofstream(std::string("checksum.values.idx"), std::ios::binary | std::ios::trunc) << corrupt;
+        EXPECT_FALSE(PageFile::read("checksum.values.idx", read)) << offset;
+    }
+}
+
+TEST(PageFile, RejectsCorruptSizesBeforeAllocating){
+    //sizes far beyond the file fail the read instead of allocating for them
+    uint32_t header[4] = {0x5844594d, 0xFFFFFFF0, 0xFFFFFFF0, RawCodec::TAG};
+    {
+        std::ofstream file("corrupt.values.idx", std::ios::binary | std::ios::trunc);
+        file.write((char*)header, sizeof(header));
+        file << "short";
+    }
+    std::string read;
+    EXPECT_FALSE(PageFile::read("corrupt.values.idx", read));
+
+    //a raw size the codec cannot produce from the stored bytes
+    header[1] = 0xFFFFFFF0;
+    header[2] = 5;
+    header[3] = LZCodec::TAG;
+    {
+        std::ofstream file("corrupt.values.idx", std::ios::binary | std::ios::trunc);
+        file.write((char*)header, sizeof(header));
+        file << "short";
+    }
+    EXPECT_FALSE(PageFile::read("corrupt.values.idx", read));
+}
+
+TEST(PageFile, ReadsFilesWithoutChecksum){
+    //the header of files written before checksums, with the magic "MYDX"
+    std::string payload = "legacy payload";
+    uint32_t header[4] = {0x5844594d, (uint32_t)payload.size(), (uint32_t)payload.size(), RawCodec::TAG};
+    {
+        std::ofstream file("legacy.values.idx", std::ios::binary | std::ios::trunc);
+        file.write((char*)header, sizeof(header));
+        file << payload;
+    }
+    std::string read;
+    ASSERT_TRUE(PageFile::read("legacy.values.idx", read));
+    EXPECT_EQ(read, payload);
+}
+
+//Writes a page the way pages were saved before the envelope: the key count,
+//the keys, then the values of a leaf
+static void writeRawPage(const std::string& path, const std::vector<int>& keys, const std::vector<int>& values){
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    int size = keys.size();
+    file.write((char*)&size, sizeof(size));
+    file.write((char*)keys.data(), keys.size() * sizeof(int));
+    file.write((char*)values.data(), values.size() * sizeof(int));
+}
+
+TEST(PageFile, OpensTreesWrittenBeforeTheEnvelope){
+    std::string payload = "no header at all";
+    std::ofstream(std::string("bare.values.idx"), std::ios::binary | std::ios::trunc) << payload;
+    std::string read;
+    ASSERT_TRUE(PageFile::read("bare.values.idx", read));
+    EXPECT_EQ(read, payload);
+
+    //a root over two leaves in the original layout, named by a meta file
+    writeRawPage("raw_left.values.idx", {0, 1, 2}, {0, 10, 20});
+    writeRawPage("raw_right.values.idx", {3, 4}, {30, 40});
+    writeRawPage("raw_root.idx", {0, 3}, {});
+    {
+        std::ofstream meta("raw_root.meta.idx", std::ios::trunc);
+        meta << "raw_left" << (char)30 << "raw_right" << (char)30;
+        std::ofstream tree("raw_tree.meta.idx", std::ios::trunc);
+        tree << 4 << std::endl << 2 << std::endl << 5 << std::endl << "raw_root" << std::endl;
+    }
+    Btree<int, int, FlatPage<int, int>> btree("raw_tree");
+    EXPECT_EQ(btree.count(), 5);
+    for(int i=0; i<5; i++){
+        ASSERT_NE(btree.get(i), (int*)NULL);
+        EXPECT_EQ(*btree.get(i), 10 * i);
+    }
+    EXPECT_EQ(btree.get(5), (int*)NULL);
+}
@@ -0,0 +1,29 @@
+#include <gtest/gtest.h>
+#include "Histogram.h"
+
+TEST(Histogram, Percentiles){
+    Histogram h;
+    for(uint64_t i=1; i<=100000; i++){
+        h.record(i);
+    }
+    EXPECT_EQ(h.count(), 100000);
+    EXPECT_EQ(h.min(), 1);
+    EXPECT_EQ(h.max(), 100000);
+    //three significant digits
+    EXPECT_NEAR(h.percentile(50), 50000, 50);
+    EXPECT_NEAR(h.percentile(99), 99000, 100);
+    EXPECT_NEAR(h.percentile(99.9), 99900, 100);
+    EXPECT_EQ(h.percentile(100), 100000);
+}
+
+TEST(Histogram, Merge){
+    Histogram a;
+    Histogram b;
+    a.record(10);
+    b.record(1000000);
+    a.merge(b);
+    EXPECT_EQ(a.count(), 2);
+    EXPECT_EQ(a.percentile(50), 10);
+    EXPECT_EQ(a.max(), 1000000);
+    EXPECT_DOUBLE_EQ(a.mean(), (10 + 1000000) / 2.0);
+}
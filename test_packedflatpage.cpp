@@ -0,0 +1,97 @@
+#include <gtest/gtest.h>
+#include <sstream>
+#include "btree.h"
+#include "PackedFlatPage.h"
+
+TEST(PackedKeys, EncodeAndSearch){
+    std::vector<int> keys;
+    for(int i=0; i<100; i++){
+        keys.push_back(-500 + i * 7);
+    }
+    PackedKeys<int> packed;
+    packed.encode(keys.data(), keys.size());
+    EXPECT_EQ(packed.count(), 100);
+    EXPECT_EQ(packed.bitsPerKey(), 10);
+    for(int i=0; i<100; i++){
+        EXPECT_EQ(packed.at(i), keys[i]);
+        EXPECT_EQ(packed.find(keys[i]), i);
+        EXPECT_EQ(packed.find(keys[i] + 1), -1);
+        EXPECT_EQ(packed.floor(keys[i] + 1), i);
+    }
+    EXPECT_EQ(packed.floor(-501), -1);
+    EXPECT_EQ(packed.floor(1000000), 99);
+}
+
+TEST(PackedKeys, FullWidthKeys){
+    long long keys[] = {std::numeric_limits<long long>::min(), -1, 0, std::numeric_limits<long long>::max()};
+    PackedKeys<long long> packed;
+    packed.encode(keys, 4);
+    EXPECT_EQ(packed.bitsPerKey(), 64);
+    for(int i=0; i<4; i++){
+        EXPECT_EQ(packed.at(i), keys[i]);
+        EXPECT_EQ(packed.find(keys[i]), i);
+    }
+}
+
+TEST(PackedKeys, RejectsCorruptHeader){
+    std::vector<int> keys = {3, 5, 8, 13};
+    PackedKeys<int> packed;
+    packed.encode(keys.data(), keys.size());
+    std::stringstream stream;
+    packed.write(stream);
+    PackedKeys<int> read;
+    EXPECT_TRUE(read.read(stream, 4));
+    EXPECT_EQ(read.at(3), 13);
+
+    //more keys than the page can hold, or a width beyond 64 bits
+    unsigned int fields[][2] = {{0xFFFFFFF0, 8}, {4, 0xFFFFFFF0}};
+    for(auto& field : fields){
+        std::stringstream corrupt;
+        int base = 0;
+        corrupt.write((char*)&field[0], sizeof(field[0]));
+        corrupt.write((char*)&base, sizeof(base));
+        corrupt.write((char*)&field[1], sizeof(field[1]));
+        EXPECT_FALSE(read.read(corrupt, 16));
+        EXPECT_EQ(read.count(), 0);
+    }
+}
+
+TEST(PackedFlatPage, PackedLeafSearch){
+    PackedFlatPage<int, int> page(64, true);
+    for(int i=0; i<50; i++){
+        page.add(1000 + 3 * i, i);
+    }
+    page.pack();
+    EXPECT_TRUE(page.isPacked());
+    //touches the packed words, the page has no key array
+    page.prefetch();
+    EXPECT_EQ(*page.getValue(1000 + 3 * 20), 20);
+    EXPECT_EQ(page.getValue(1001), (int*)NULL);
+    EXPECT_EQ(page.firstKey(), 1000);
+    EXPECT_EQ(page.lastKey(), 1000 + 3 * 49);
+
+    page.add(1001, -1);
+    EXPECT_FALSE(page.isPacked());
+    EXPECT_EQ(page.count(), 51);
+    EXPECT_EQ(*page.getValue(1001), -1);
+    EXPECT_EQ(*page.getValue(1000 + 3 * 20), 20);
+}
+
+TEST(PackedFlatPage, SaveAndOpen){
+    Btree<int, int, PackedFlatPage<int, int>> btree(16, 0, 0);
+    for(int i=1; i<=500; i++){
+        btree.put(i * 2, i);
+    }
+    btree.save("packed_tree");
+
+    Btree<int, int, PackedFlatPage<int, int>> loaded("packed_tree");
+    for(int i=1; i<=500; i++){
+        ASSERT_NE(loaded.get(i * 2), (int*)NULL);
+        EXPECT_EQ(*loaded.get(i * 2), i);
+        EXPECT_EQ(loaded.get(i * 2 + 1), (int*)NULL);
+    }
+    loaded.put(3, 3);
+    loaded.deleteKey(4);
+    EXPECT_EQ(*loaded.get(3), 3);
+    EXPECT_EQ(loaded.get(4), (int*)NULL);
+}
@@ -0,0 +1,127 @@
+#include <gtest/gtest.h>
+#include "Prefetcher.h"
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+
+typedef CompoundObjectsFlatPage<std::string, std::string> PrefetchPage;
+
+TEST(Prefetcher, TakePrefetchedPage){
+    PrefetchPage page(4, true);
+    page.add("a", "1");
+    page.add("b", "2");
+    page.save();
+
+    Prefetcher::instance().prefetch(page.getId());
+    bool bottom = false;
+    bool ok = false;
+    std::string data;
+    std::string meta;
+    EXPECT_TRUE(Prefetcher::instance().take(page.getId(), bottom, data, meta, ok));
+    EXPECT_TRUE(ok);
+    EXPECT_TRUE(bottom);
+    EXPECT_FALSE(data.empty());
+    //handed over only once
+    EXPECT_FALSE(Prefetcher::instance().take(page.getId(), bottom, data, meta, ok));
+}
+
+TEST(Prefetcher, BatchAndRangeLookupsOnColdTree){
+    Btree<std::string, std::string, PrefetchPage> btree(4, "", "");
+    for(int i=100; i<400; i++){
+        btree.put(std::to_string(i), "v" + std::to_string(i));
+    }
+    btree.save("prefetch_tree");
+
+    Btree<std::string, std::string, PrefetchPage> cold("prefetch_tree");
+    std::vector<std::string> keys;
+    for(int i=90; i<410; i += 3){
+        keys.push_back(std::to_string(i));
+    }
+    std::vector<std::string*> values = cold.get(keys);
+    ASSERT_EQ(values.size(), keys.size());
+    for(size_t i=0; i<keys.size(); i++){
+        int k = std::stoi(keys[i]);
+        if(k >= 100 && k < 400){
+            ASSERT_NE(values[i], (std::string*)NULL);
+            EXPECT_EQ(*values[i], "v" + keys[i]);
+        } else {
+            EXPECT_EQ(values[i], (std::string*)NULL);
+        }
+    }
+
+    Btree<std::string, std::string, PrefetchPage> scan("prefetch_tree");
+    Iterator<std::string, std::string, Page<std::string, std::string>> it = scan.get("150", "160");
+    for(int i=150; i<=160; i++){
+        ASSERT_FALSE(it.isEnd());
+        EXPECT_EQ(**it, "v" + std::to_string(i));
+        it++;
+    }
+    Prefetcher::instance().clear();
+}
+
+static unsigned int hotListSize(const std::string& name){
+    std::ifstream file(name + ".hot.idx");
+    unsigned int lines = 0;
+    std::string id;
+    while(std::getline(file, id)){
+        lines++;
+    }
+    return lines;
+}
+
+TEST(Prefetcher, ReopenPrefetchesHotPages){
+    {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1);
+        for(int i=0; i<2000; i++){
+            btree.put(i, i);
+        }
+        btree.save("hot_tree");
+        //every page was in memory
+        EXPECT_EQ(hotListSize("hot_tree"), btree.stats().residentPages - 1);
+    }
+    {
+        Btree<int, int, FlatPage<int, int>> btree("hot_tree");
+        Stats before = Stats::collect();
+        EXPECT_EQ(*btree.get(1234), 1234);
+        Stats after = Stats::collect();
+        EXPECT_EQ(after.pageLoads - before.pageLoads, btree.get_height() - 1);
+        EXPECT_EQ(after.prefetchedLoads - before.prefetchedLoads, btree.get_height() - 1);
+        Prefetcher::instance().clear();
+    }
+    {
+        //only the path to 7 is in memory at this save
+        Btree<int, int, FlatPage<int, int>> btree("hot_tree");
+        Prefetcher::instance().clear();
+        EXPECT_EQ(*btree.get(7), 7);
+        btree.save("hot_tree");
+        EXPECT_EQ(hotListSize("hot_tree"), btree.get_height() - 1);
+        btree.setHotPages(0);
+        btree.save("hot_tree");
+        EXPECT_FALSE(PageFile::exists("hot_tree.hot.idx"));
+    }
+}
+
+TEST(Prefetcher, UnclaimedHotPagesAreDropped){
+    {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1);
+        for(int i=0; i<2000; i++){
+            btree.put(i, i);
+        }
+        btree.save("unclaimed_tree");
+    }
+    Prefetcher::instance().clear();
+    {
+        //the pages off the path to 7 are never opened
+        Btree<int, int, FlatPage<int, int>> btree("unclaimed_tree");
+        EXPECT_EQ(*btree.get(7), 7);
+        EXPECT_GT(Prefetcher::instance().size(), 0);
+    }
+    EXPECT_EQ(Prefetcher::instance().size(), 0);
+    {
+        Btree<int, int, FlatPage<int, int>> btree("unclaimed_tree");
+        btree.put(2000, 2000);
+        btree.save("unclaimed_tree");
+        EXPECT_EQ(Prefetcher::instance().size(), 0);
+        EXPECT_EQ(*btree.get(1999), 1999);
+    }
+    EXPECT_EQ(Prefetcher::instance().size(), 0);
+}
@@ -0,0 +1,184 @@
+#include <gtest/gtest.h>
+#include <fstream>
+#include "Crc32c.h"
+#include "Superblock.h"
+#include "Verifier.h"
+#include "btree.h"
+
+TEST(Crc32c, CheckValues){
+    EXPECT_EQ(Crc32c::compute("123456789", 9), 0xe3069283u);
+    EXPECT_EQ(Crc32c::compute("", 0), 0u);
+    unsigned char zeros[32] = {0};
+    EXPECT_EQ(Crc32c::compute(zeros, sizeof(zeros)), 0x8a9136aau);
+}
+
+TEST(Crc32c, Continues){
+    const char* text = "The quick brown fox jumps over the lazy dog";
+    uint32_t crc = Crc32c::compute(text, 10);
+    EXPECT_EQ(Crc32c::compute(text + 10, strlen(text) - 10, crc), Crc32c::compute(text, strlen(text)));
+}
+
+#ifdef CRC32C_HARDWARE
+TEST(Crc32c, HardwareMatchesSoftware){
+    if(!Crc32c::hasHardware())
+        return;
+    std::string data;
+    for(int i=0; i<1000; i++){
+        data.push_back((char)(i * 131 + 7));
+    }
+    for(size_t offset=0; offset<9; offset++){
+        for(size_t size : {0, 1, 7, 8, 9, 63, 500}){
+            EXPECT_EQ(Crc32c::hardware(data.data() + offset, size, 0x1234), Crc32c::software(data.data() + offset, size, 0x1234));
+        }
+    }
+}
+#endif
+
+TEST(Superblock, ChecksumRejectsTornWrites){
+    Superblock super;
+    super.sequence = 7;
+    super.order = 5;
+    super.height = 2;
+    super.n = 100;
+    super.rootId = "root";
+    super.counting = true;
+    super.summary = "sum";
+    ASSERT_TRUE(super.write("torn"));
+
+    Superblock read;
+    ASSERT_TRUE(read.read(Superblock::path("torn", 1)));
+    EXPECT_EQ(read.sequence, 7u);
+    EXPECT_EQ(read.rootId, "root");
+    EXPECT_TRUE(read.counting);
+    EXPECT_EQ(read.summary, "sum");
+
+    std::string data;
+    {
+        std::ifstream file(Superblock::path("torn", 1));
+        std::getline(file, data, '\0');
+    }
+    {
+        std::ofstream file(Superblock::path("torn", 1), std::ios::trunc);
+        file << data.substr(0, data.size() / 2);
+    }
+    EXPECT_FALSE(read.read(Superblock::path("torn", 1)));
+    {
+        std::ofstream file(Superblock::path("torn", 1), std::ios::trunc);
+        file << "8" << data.substr(1);
+    }
+    EXPECT_FALSE(read.read(Superblock::path("torn", 1)));
+}
+
+TEST(Superblock, SaveNeverOverwritesCommittedPages){
+    Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+    for(int i=0; i<500; i++){
+        btree.put(i, i);
+    }
+    btree.save("shadow");
+    Superblock first;
+    ASSERT_TRUE(Superblock::load("shadow", first));
+
+    btree.put(250, -250);
+    btree.save("shadow");
+    Superblock second;
+    ASSERT_TRUE(Superblock::load("shadow", second));
+    EXPECT_EQ(second.sequence, first.sequence + 1);
+    //the changed path went to new files and the old root is gone
+    EXPECT_NE(second.rootId, first.rootId);
+    EXPECT_FALSE(PageFile::exists(first.rootId + ".idx"));
+
+    //a save without changes commits the same root
+    btree.save("shadow");
+    Superblock third;
+    ASSERT_TRUE(Superblock::load("shadow", third));
+    EXPECT_EQ(third.rootId, second.rootId);
+
+    Btree<int, int, FlatPage<int, int>> loaded("shadow");
+    EXPECT_EQ(*loaded.get(250), -250);
+    EXPECT_EQ(*loaded.get(499), 499);
+}
+
+TEST(Superblock, TornCommitFallsBackToPreviousSave){
+    Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+    for(int i=0; i<500; i++){
+        btree.put(i, i);
+    }
+    btree.save("fallback");
+    //a live snapshot keeps the pages of the first save on disk, as an
+    //interrupted save would
+    Btree<int, int, FlatPage<int, int>>* snapshot = btree.snapshot();
+    for(int i=0; i<500; i+=2){
+        btree.put(i, -i);
+    }
+    btree.save("fallback");
+    uint64_t sequence = Superblock::latest("fallback");
+    {
+        std::ofstream file(Superblock::path("fallback", sequence % 2), std::ios::trunc);
+        file << sequence << std::endl << "5" << std::endl;
+    }
+
+    Btree<int, int, FlatPage<int, int>> loaded("fallback");
+    for(int i=0; i<500; i++){
+        ASSERT_EQ(*loaded.get(i), i);
+    }
+    delete snapshot;
+}
+
+TEST(Superblock, LoadsTreesSavedWithMetaFile){
+    {
+        Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+        for(int i=0; i<300; i++){
+            btree.put(i, i * 3);
+        }
+        btree.save("legacy");
+    }
+    std::remove(Superblock::path("legacy", 0).c_str());
+    std::remove(Superblock::path("legacy", 1).c_str());
+    Btree<int, int, FlatPage<int, int>> loaded("legacy");
+    EXPECT_EQ(loaded.count(), 300);
+    EXPECT_EQ(*loaded.get(299), 897);
+    loaded.put(300, 900);
+    loaded.save("legacy");
+    Btree<int, int, FlatPage<int, int>> reloaded("legacy");
+    EXPECT_EQ(*reloaded.get(300), 900);
+}
+
+TEST(Verifier, IgnoresCountsOfTreesNoLongerCounting){
+    Btree<int, int, FlatPage<int, int>> btree(5, -1, -1, false);
+    for(int i=0; i<500; i++){
+        btree.put(i, i);
+    }
+    btree.setCounting(true);
+    EXPECT_EQ(btree.rank(10), 10);
+    btree.save("counted");
+    Superblock super;
+    ASSERT_TRUE(Superblock::load("counted", super));
+    EXPECT_TRUE(super.counting);
+    ThreadPool pool(4);
+    {
+        Report report;
+        checkAllFiles(super, pool, report);
+        Verifier<int, int>(super.order, super.height, super.counting, report).run<FlatPage<int, int>>(super.rootId, pool);
+        EXPECT_EQ(report.failures(), 0);
+    }
+
+    //the deletes leave the counts stored before behind
+    btree.setCounting(false);
+    for(int i=0; i<100; i++){
+        btree.deleteKey(i * 3);
+    }
+    btree.save("counted");
+    ASSERT_TRUE(Superblock::load("counted", super));
+    EXPECT_FALSE(super.counting);
+    {
+        Report report;
+        checkAllFiles(super, pool, report);
+        Verifier<int, int>(super.order, super.height, super.counting, report).run<FlatPage<int, int>>(super.rootId, pool);
+        EXPECT_EQ(report.failures(), 0);
+    }
+    {
+        Report report;
+        Verifier<int, int>(super.order, super.height, true, report).run<FlatPage<int, int>>(super.rootId, pool);
+        EXPECT_GT(report.failures(), 0);
+    }
+}
@@ -0,0 +1,33 @@
+#include <gtest/gtest.h>
+#include <type_traits>
+#include "btree.h"
+#include "Tracer.h"
+
+TEST(Tracer, NoTracerIsEmpty){
+    EXPECT_FALSE(NoTracer::ENABLED);
+    EXPECT_TRUE(std::is_empty<NoTracer::Scope>::value);
+}
+
+TEST(Tracer, ChromeTracerRecordsPhases){
+    typedef Btree<int, int, FlatPage<int, int>, ChromeTracer> TracedTree;
+    TracedTree btree(4, -1, -1);
+    for(int i=0; i<64; i++){
+        btree.put(i, i);
+    }
+    btree.save("traced_tree");
+
+    ChromeTracer::clear();
+    TracedTree loaded("traced_tree");
+    EXPECT_EQ(*loaded.get(42), 42);
+    //get, then a descent, a search and a load for every level below the root
+    EXPECT_EQ(ChromeTracer::count(), 1 + 2 * loaded.get_height() + (loaded.get_height() - 1));
+    loaded.deleteKey(42);
+    EXPECT_TRUE(ChromeTracer::write("traced_tree.json"));
+
+    std::ifstream file("traced_tree.json");
+    std::string trace((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+    EXPECT_NE(trace.find("\"name\": \"load\""), std::string::npos);
+    EXPECT_NE(trace.find("\"name\": \"delete\""), std::string::npos);
+    EXPECT_NE(trace.find("\"ph\": \"X\""), std::string::npos);
+    std::remove("traced_tree.json");
+}
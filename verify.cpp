@@ -0,0 +1,67 @@
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include "CompoundObjectsFlatPage.h"
+#include "PackedFlatPage.h"
+#include "Verifier.h"
+
+static void usage(){
+    std::cout << "usage: verify <tree name> [-p flat|compound|packed] [-t threads]" << std::endl
+              << "  flat reads FlatPage<int, int> trees, compound CompoundObjectsFlatPage<string, string>\n"
+              << "  and packed PackedFlatPage<int, int>" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    std::string name;
+    std::string pages = "flat";
+    int threads = std::thread::hardware_concurrency();
+    for(int i=1; i<argc; i++){
+        std::string arg = argv[i];
+        if(arg == "-p" && i + 1 < argc){
+            pages = argv[++i];
+        } else if(arg == "-t" && i + 1 < argc){
+            threads = std::stoi(argv[++i]);
+        } else if(name.empty() && arg[0] != '-'){
+            name = arg;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+    if(name.empty() || (pages != "flat" && pages != "compound" && pages != "packed")){
+        usage();
+        return 1;
+    }
+    Superblock super;
+    if(!Superblock::load(name, super)){
+        std::cout << "Error: no tree named " << name << std::endl;
+        return 1;
+    }
+
+    ThreadPool pool(threads);
+    Report report;
+    checkAllFiles(super, pool, report);
+    std::cout << "files: " << report.pages << " pages, " << report.bytes << " bytes checked" << std::endl;
+    if(report.failures() == 0){
+        report.pages = 0;
+        if(pages == "compound"){
+            Verifier<std::string, std::string> verifier(super.order, super.height, super.counting, report);
+            verifier.run<CompoundObjectsFlatPage<std::string, std::string>>(super.rootId, pool);
+        } else if(pages == "packed"){
+            Verifier<int, int> verifier(super.order, super.height, super.counting, report);
+            verifier.run<PackedFlatPage<int, int>>(super.rootId, pool);
+        } else {
+            Verifier<int, int> verifier(super.order, super.height, super.counting, report);
+            verifier.run<FlatPage<int, int>>(super.rootId, pool);
+        }
+        std::cout << "tree: " << report.pages << " pages, " << report.entries << " entries checked" << std::endl;
+    }
+    if(report.failures() > 0){
+        report.print();
+        std::cout << report.failures() << " problems found" << std::endl;
+        return 1;
+    }
+    std::cout << "ok" << std::endl;
+    return 0;
+}
@@ -0,0 +1,324 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "btree.h"
+#include "CompoundObjectsFlatPage.h"
+#include "Histogram.h"
+#include "KeyGenerator.h"
+
+//YCSB style workload driver: loads a tree, then runs one of the core
+//workloads A-F against it from several threads and reports throughput over
+//time and per operation latency percentiles.
+
+enum Operation { READ, UPDATE, INSERT, SCAN, READ_MODIFY_WRITE, OPERATIONS };
+static const char* OPERATION_NAMES[] = {"READ", "UPDATE", "INSERT", "SCAN", "READ-MODIFY-WRITE"};
+
+struct Workload{
+    char name;
+    double read;
+    double update;
+    double insert;
+    double scan;
+    double readModifyWrite;
+    //requests go to the newest records instead of zipfian ones
+    bool latest;
+};
+
+static const Workload WORKLOADS[] = {
+    {'A', 0.50, 0.50, 0.00, 0.00, 0.00, false},
+    {'B', 0.95, 0.05, 0.00, 0.00, 0.00, false},
+    {'C', 1.00, 0.00, 0.00, 0.00, 0.00, false},
+    {'D', 0.95, 0.00, 0.05, 0.00, 0.00, true},
+    {'E', 0.00, 0.00, 0.05, 0.95, 0.00, false},
+    {'F', 0.50, 0.00, 0.00, 0.00, 0.50, false},
+};
+
+struct Options{
+    Workload workload;
+    uint64_t records;
+    uint64_t operations;
+    int threads;
+    int order;
+    bool compound;
+    bool disk;
+    int maxScan;
+    std::string name;
+};
+
+struct IntRecords{
+    typedef int Key;
+    typedef int Value;
+    typedef FlatPage<int, int> PageType;
+    static Key key(uint64_t i){ return (int)i; }
+    static Value value(uint64_t i){ return (int)(i * 31); }
+    static Key sentinel(){ return -1; }
+};
+
+struct StringRecords{
+    typedef std::string Key;
+    typedef std::string Value;
+    typedef CompoundObjectsFlatPage<std::string, std::string> PageType;
+    static Key key(uint64_t i){
+        char buffer[32];
+        snprintf(buffer, sizeof(buffer), "user%016llu", (unsigned long long)i);
+        return buffer;
+    }
+    static Value value(uint64_t i){ return "field0=" + std::to_string(i) + std::string(80, 'x'); }
+    static Key sentinel(){ return ""; }
+};
+
+static uint64_t now(){
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template<class Records> class Driver{
+private:
+    typedef Btree<typename Records::Key, typename Records::Value, typename Records::PageType> Tree;
+
+    Options options;
+    Tree* tree;
+    //the tree is not thread safe, every operation holds this lock
+    std::mutex lock;
+    std::atomic<uint64_t> inserted;
+    std::atomic<uint64_t> done;
+
+    void run(int thread, uint64_t operations, Histogram* histograms){
+        std::unique_ptr<KeyGenerator> requests;
+        if(this->options.workload.latest)
+            requests.reset(new ZipfianGenerator(this->options.records, false, ZipfianGenerator::THETA, thread + 1));
+        else
+            requests.reset(new ZipfianGenerator(this->options.records, true, ZipfianGenerator::THETA, thread + 1));
+        UniformGenerator choice(1000000, thread + 101);
+        UniformGenerator scanLength(this->options.maxScan, thread + 201);
+        const Workload& w = this->options.workload;
+
+        for(uint64_t i=0; i<operations; i++){
+            double p = choice.next() / 1000000.0;
+            Operation op;
+            if(p < w.read)
+                op = READ;
+            else if(p < w.read + w.update)
+                op = UPDATE;
+            else if(p < w.read + w.update + w.insert)
+                op = INSERT;
+            else if(p < w.read + w.update + w.insert + w.scan)
+                op = SCAN;
+            else
+                op = READ_MODIFY_WRITE;
+
+            uint64_t index;
+            uint64_t newest = this->inserted.load(std::memory_order_relaxed);
+            if(op == INSERT){
+                index = this->inserted.fetch_add(1);
+            } else if(w.latest){
+                uint64_t back = requests->next();
+                index = back < newest ? newest - 1 - back : 0;
+            } else {
+                index = requests->next();
+            }
+            typename Records::Key key = Records::key(index);
+
+            uint64_t start = now();
+            {
+                std::lock_guard<std::mutex> guard(this->lock);
+                switch(op){
+                case READ:
+                    this->tree->get(key);
+                    break;
+                case UPDATE:
+                case INSERT:
+                    this->tree->put(key, Records::value(i));
+                    break;
+                case SCAN: {
+                    auto it = this->tree->get(key, Records::key(index + 1 + scanLength.next()));
+                    while(!it.isEnd()){
+                        (void)*it;
+                        it++;
+                    }
+                    break;
+                }
+                case READ_MODIFY_WRITE:
+                    //reads the record and writes it back in one descent
+                    this->tree->upsert(key, [i](typename Records::Value& value){
+                        value = Records::value(i);
+                    });
+                    break;
+                default:
+                    break;
+                }
+            }
+            histograms[op].record(now() - start);
+            this->done.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+public:
+    Driver(const Options& options) : inserted(options.records), done(0){
+        this->options = options;
+        this->tree = NULL;
+    }
+
+    void load(){
+        uint64_t start = now();
+        this->tree = new Tree(this->options.order, Records::sentinel(), Records::value(0), !this->options.disk);
+        //load in hashed order so the tree is not built from sorted input
+        for(uint64_t i=0; i<this->options.records; i++){
+            uint64_t index = (i * 2654435761ULL) % this->options.records;
+            this->tree->put(Records::key(index), Records::value(index));
+        }
+        std::cout << "load: " << this->options.records << " records in " << (now() - start) / 1e9 << " s" << std::endl;
+
+        if(this->options.disk){
+            start = now();
+            this->tree->save(this->options.name);
+            delete this->tree;
+            //reopen so the run starts from cold pages
+            this->tree = new Tree(this->options.name);
+            std::cout << "save and reopen: " << (now() - start) / 1e9 << " s" << std::endl;
+        }
+    }
+
+    void run(){
+        std::vector<std::vector<Histogram>> perThread(this->options.threads, std::vector<Histogram>(OPERATIONS));
+        std::vector<std::thread> threads;
+        std::atomic<bool> running(true);
+
+        uint64_t start = now();
+        for(int t=0; t<this->options.threads; t++){
+            uint64_t share = this->options.operations / this->options.threads;
+            if(t == 0)
+                share += this->options.operations % this->options.threads;
+            threads.push_back(std::thread([this, t, share, &perThread]{
+                this->run(t, share, perThread[t].data());
+            }));
+        }
+
+        std::thread reporter([this, &running, start]{
+            uint64_t last = 0;
+            int second = 0;
+            while(running.load()){
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+                uint64_t total = this->done.load();
+                second++;
+                std::cout << second << " sec: " << total << " operations; " << (total - last) << " ops/sec" << std::endl;
+                last = total;
+            }
+        });
+
+        for(size_t t=0; t<threads.size(); t++){
+            threads[t].join();
+        }
+        double elapsed = (now() - start) / 1e9;
+        running = false;
+        reporter.join();
+
+        std::vector<Histogram> merged(OPERATIONS);
+        for(int t=0; t<this->options.threads; t++){
+            for(int op=0; op<OPERATIONS; op++){
+                merged[op].merge(perThread[t][op]);
+            }
+        }
+
+        std::cout << "[OVERALL] RunTime(s): " << elapsed << std::endl;
+        std::cout << "[OVERALL] Throughput(ops/sec): " << this->options.operations / elapsed << std::endl;
+        for(int op=0; op<OPERATIONS; op++){
+            const Histogram& h = merged[op];
+            if(h.count() == 0)
+                continue;
+            std::cout << "[" << OPERATION_NAMES[op] << "] Operations: " << h.count()
+                      << ", AverageLatency(us): " << h.mean() / 1000.0
+                      << ", MinLatency(us): " << h.min() / 1000.0
+                      << ", p50(us): " << h.percentile(50) / 1000.0
+                      << ", p99(us): " << h.percentile(99) / 1000.0
+                      << ", p999(us): " << h.percentile(99.9) / 1000.0
+                      << ", MaxLatency(us): " << h.max() / 1000.0 << std::endl;
+        }
+
+        if(this->options.disk){
+            uint64_t saveStart = now();
+            this->tree->save(this->options.name);
+            std::cout << "[SAVE] RunTime(s): " << (now() - saveStart) / 1e9 << std::endl;
+        }
+    }
+
+    ~Driver(){
+        delete this->tree;
+    }
+};
+
+static void usage(){
+    std::cout << "usage: ycsb [-w A-F] [-r records] [-o operations] [-t threads] [-p flat|compound]" << std::endl
+              << "            [-k order] [-s max scan length] [-d name (on-disk mode)]" << std::endl;
+}
+
+int main(int argc, char* argv[]){
+    Options options;
+    options.workload = WORKLOADS[0];
+    options.records = 100000;
+    options.operations = 1000000;
+    options.threads = 1;
+    options.order = 64;
+    options.compound = false;
+    options.disk = false;
+    options.maxScan = 100;
+
+    for(int i=1; i<argc; i++){
+        std::string arg = argv[i];
+        if(i + 1 >= argc){
+            usage();
+            return 1;
+        }
+        std::string value = argv[++i];
+        if(arg == "-w"){
+            char name = toupper(value[0]);
+            if(name < 'A' || name > 'F'){
+                usage();
+                return 1;
+            }
+            options.workload = WORKLOADS[name - 'A'];
+        } else if(arg == "-r"){
+            options.records = std::stoull(value);
+        } else if(arg == "-o"){
+            options.operations = std::stoull(value);
+        } else if(arg == "-t"){
+            options.threads = std::stoi(value);
+        } else if(arg == "-p"){
+            options.compound = value == "compound";
+        } else if(arg == "-k"){
+            options.order = std::stoi(value);
+        } else if(arg == "-s"){
+            options.maxScan = std::stoi(value);
+        } else if(arg == "-d"){
+            options.disk = true;
+            options.name = value;
+        } else {
+            usage();
+            return 1;
+        }
+    }
+
+    std::cout << "workload " << options.workload.name << ", " << options.records << " records, "
+              << options.operations << " operations, " << options.threads << " threads, "
+              << (options.compound ? "CompoundObjectsFlatPage" : "FlatPage") << " order " << options.order
+              << (options.disk ? ", on disk" : ", in memory") << std::endl;
+
+    if(options.compound){
+        Driver<StringRecords> driver(options);
+        driver.load();
+        driver.run();
+    } else {
+        Driver<IntRecords> driver(options);
+        driver.load();
+        driver.run();
+    }
+    return 0;
+}